@@ -1,20 +1,40 @@
 #include <cstdint>
 #include <cmath>
+#include <algorithm>
+#include <limits>
 
 #include "xMath.hpp"
 #include "Graphical.hpp"
 #include "EngCharacter.hpp"
+#include "Trace.hpp"
 
 using xMATH::Float2;
 using xMATH::PI;
 
 namespace GAME {
 
+/**
+ * The angle to add to `from` to get to `to` turning the short way around.
+ * Both are facing angles, as atan2 gives them.
+ */
+static float
+turn(float from, float to) noexcept {
+  float d_angle = to - from;
+  if (d_angle > PI<float>()) {
+    d_angle -= 2.0f*PI<float>();
+  }
+  else if (d_angle < -PI<float>()) {
+    d_angle += 2.0f*PI<float>();
+  }
+  return d_angle;
+}
+
 EngCharacter::
 EngCharacter(const Float2 position,
           GRAL::Image (* const images)[NUM_BODY_PIECES],
           GRAL::Image *fire_particle,
-          float firing_freq_ms) noexcept
+          float firing_freq_ms,
+          int max_catch_up_shots) noexcept
   : facing_unit_direction {1.0f, 0.0f},
     facing_angle {0.0f},
     position {position},
@@ -22,10 +42,17 @@ EngCharacter(const Float2 position,
     forward {0.0f},
     right {0.0f},
     images {images},
+    sprite_cache {nullptr},
     anim_bouncing_ms {0},
     firing_since_ms {UINT32_MAX},
     firing_freq_ms {firing_freq_ms},
-    fire_particle {fire_particle}
+    fire_particle {fire_particle},
+    shots_fired {0},
+    max_catch_up_shots {max_catch_up_shots},
+    last_muzzle {weapon_top()},
+    last_facing_angle {facing_angle},
+    prev_position {position},
+    prev_facing_angle {facing_angle}
 {}
 
 void
@@ -51,12 +78,10 @@ weapon_face(const Float2 facing_point) noexcept {
    * Given this rotated vector, we add it to the position (that is of the head)
    * and we'll then have the weapon's position.
    *
-   * To do the -90 degrees correction, we rotate the facing_unit_direction
-   * by -90 degrees.
+   * To do the -90 degrees correction, we turn the body's transform by -90
+   * degrees.
    */
-  const Float2 adjust = xMATH::rotate(facing_unit_direction,
-                                      Float2{0.0f, -1.0f});
-  const Float2 weapon_pos = position + xMATH::rotate(skeleton[WEAPON], adjust);
+  const Float2 weapon_pos = body().turned(-1).apply(skeleton[WEAPON]);
   facing_unit_direction = xMATH::normalize(facing_point - weapon_pos);
   facing_angle = std::atan2(facing_unit_direction.y(),
                             facing_unit_direction.x());
@@ -132,6 +157,7 @@ void
 EngCharacter::
 start_firing(uint32_t ms_now) noexcept {
   firing_since_ms = ms_now;
+  shots_fired = 0;
 }
 
 void
@@ -144,41 +170,94 @@ stop_firing() noexcept {
 void
 EngCharacter::
 fire(ParticlesSystem *particles, uint32_t ms_now) noexcept {
+  emit(particles, ms_now, weapon_top(), facing_angle);
+}
+
+void
+EngCharacter::
+emit(ParticlesSystem *particles, uint32_t ms_start,
+     Float2 muzzle, float angle) noexcept
+{
   ParticlesBatchSetup batch_setup;
-  batch_setup.start_position = weapon_top();
-  batch_setup.center_out_angle = facing_angle;
+  batch_setup.start_position = muzzle;
+  batch_setup.center_out_angle = angle;
   batch_setup.spread_angle = PI<float>()*0.01f;
   batch_setup.ms_min_vel = 0.05f;
   batch_setup.ms_max_vel = 0.3f;
   batch_setup.color = {255, 85, 24, 255};
-  batch_setup.ms_start = ms_now;
+  batch_setup.ms_start = ms_start;
   batch_setup.ms_duration = 1000;
   batch_setup.img = fire_particle;
+  batch_setup.num_particles = 30;
   particles->add_batch(batch_setup);
 }
 
 void
 EngCharacter::
-render(GRAL::Screen *screen) noexcept {
+render(GRAL::SpriteBatch *sprites, float alpha) {
+  TRACE_Zone("EngCharacter::render");
+  const xMATH::Transform2D body_now = body(alpha);
+
+  if (sprite_cache) {
+    GRAL::Image *img = sprite_cache->pose(anim_bouncing_ms);
+    if (img) {
+      GRAL::Sprite sprite;
+      sprite.img = img;
+      sprite.center = sprite_cache->center();
+      sprite.angle = 0.0f;
+      sprite.rot_center = Float2(0.0f, 0.0f);
+      sprite.color = xSDL::WHITE;
+      sprite.flags = 0;
+      sprites->add(sprite, body_now);
+      return;
+    }
+  }
+
   constexpr float DEG_TO_RAD {PI<float>()/180.0f};
 
-  float bouncing_angle {(anim_bouncing_ms/2 % 360) * DEG_TO_RAD};
+  Float2 aux_skeleton[NUM_BODY_PIECES];
+  pose(bouncing_degrees(anim_bouncing_ms) * DEG_TO_RAD, aux_skeleton);
+
+  // The pieces are placed in the body's frame, so they all share its
+  // rotation.
+  GRAL::Sprite pieces[NUM_BODY_PIECES];
+  for (int i = 0; i < NUM_BODY_PIECES; i++) {
+    GRAL::Sprite &piece = pieces[NUM_BODY_PIECES-1 - i];
+    piece.img = (*images)+i;
+    piece.center = aux_skeleton[i];
+    piece.angle = 0.0f;
+    piece.rot_center = Float2(0.0f, 0.0f);
+    piece.color = xSDL::WHITE;
+    piece.flags = GRAL::Sprite::ROTATE_270;
+  }
+  sprites->add(pieces, NUM_BODY_PIECES, body_now);
+}
+
+void
+EngCharacter::
+use_sprite_cache(EngSpriteCache *cache) noexcept {
+  SDL_assert(!cache || cache->images() == images);
+  sprite_cache = cache;
+}
+
+void
+EngCharacter::
+pose(float bouncing_angle, Float2 pieces[NUM_BODY_PIECES]) noexcept {
   float sin {std::sin(bouncing_angle)};
   float cos {std::cos(bouncing_angle)};
 
-  // TODO? Make this const?
-  Float2 aux_skeleton[NUM_BODY_PIECES];
-  std::copy(skeleton, skeleton + NUM_BODY_PIECES, aux_skeleton);
-  aux_skeleton[SHOULDER_LEFT].y() += 0.5f*sin;
-  aux_skeleton[SHOULDER_RIGHT].y() += 0.5f*cos;
-  aux_skeleton[ARM_LEFT].y() += 4*cos;
-  aux_skeleton[ARM_RIGHT].y() += 4*sin;
-  aux_skeleton[WEAPON].y() += 4*sin;
-
-  for (int i = NUM_BODY_PIECES-1; i >= 0; i--) {
-    screen->draw_image_270((*images)+i, position + aux_skeleton[i],
-                           facing_angle, position);
-  }
+  std::copy(skeleton, skeleton + NUM_BODY_PIECES, pieces);
+  pieces[SHOULDER_LEFT].y() += 0.5f*sin;
+  pieces[SHOULDER_RIGHT].y() += 0.5f*cos;
+  pieces[ARM_LEFT].y() += 4*cos;
+  pieces[ARM_RIGHT].y() += 4*sin;
+  pieces[WEAPON].y() += 4*sin;
+}
+
+uint32_t
+EngCharacter::
+bouncing_degrees(uint32_t anim_bouncing_ms) noexcept {
+  return anim_bouncing_ms/2 % 360;
 }
 
 void
@@ -187,6 +266,10 @@ update(ParticlesSystem *particles,
        uint32_t ms_now,
        Uint32 dt_ms) noexcept
 {
+  TRACE_Zone("EngCharacter::update");
+  prev_position = position;
+  prev_facing_angle = facing_angle;
+
   // Only update bouncing ms if moving. Comparison to floating points with
   // == and != is fine because of how they're put in there. Check the other
   // member functions (stop_forward for example).
@@ -201,40 +284,213 @@ update(ParticlesSystem *particles,
     return (forward != 0.0f && right != 0.0f) ? inv_sqrt2 : 1.0f;
   }());
 
+  // Both movements are quarter turns away from the facing direction, so
+  // they're taken from the body's transform.
+  const xMATH::Transform2D body_now = body();
+
   if (forward != 0.0f) {
-    float angle {facing_angle + PI<float>()*(0.5f + (forward+1.0f)/2.0f)};
+    // A 270 degrees turn for forward, 90 for backward.
     Float2 delta_pos = Float2(0, component_speed*speed*dt_ms);
-    Float2 rot_angle(std::cos(angle), std::sin(angle));
-    position += xMATH::rotate(delta_pos, rot_angle);
+    position += body_now.turned(forward > 0.0f ? 3 : 1).
+                apply_rotation(delta_pos);
   }
 
   if (right != 0.0f) {
-    float angle {facing_angle - right*PI<float>()*0.5f};
     Float2 delta_pos(component_speed*speed*dt_ms, 0);
-    Float2 rot_angle(std::cos(angle), std::sin(angle));
-    position += xMATH::rotate(delta_pos, rot_angle);
+    position += body_now.turned(right > 0.0f ? -1 : 1).
+                apply_rotation(delta_pos);
   }
 
+  const Float2 muzzle = weapon_top();
+
   if (firing_since_ms != UINT32_MAX) {
-    uint32_t inv_firing_freq_ms = 1.0f/firing_freq_ms;
-    int shots = (ms_now - firing_since_ms)*firing_freq_ms;
-    if (shots >= 1) {
-      do {
-        fire(particles, ms_now);
-        firing_since_ms += inv_firing_freq_ms;
-        --shots;
-      } while (shots >= 1);
+    // Shot n is due n/firing_freq_ms ms after firing started.
+    const uint32_t shots_due = (ms_now - firing_since_ms)*
+                               double(firing_freq_ms);
+    if (shots_due > shots_fired + max_catch_up_shots) {
+      shots_fired = shots_due - max_catch_up_shots;
+    }
+
+    const float d_angle = turn(last_facing_angle, facing_angle);
+
+    const uint32_t frame_start_ms = ms_now - dt_ms;
+    while (shots_fired < shots_due) {
+      shots_fired++;
+      const uint32_t shot_ms = firing_since_ms +
+                               uint32_t(shots_fired/double(firing_freq_ms));
+
+      // How far into this frame the shot is. Shots due before it (firing
+      // just started, or catching up) go from where the last frame ended.
+      const int32_t into_frame_ms = shot_ms - frame_start_ms;
+      float t = 1.0f;
+      if (into_frame_ms <= 0) {
+        t = 0.0f;
+      }
+      else if (uint32_t(into_frame_ms) < dt_ms) {
+        t = float(into_frame_ms)/dt_ms;
+      }
+
+      emit(particles, shot_ms, last_muzzle + t*(muzzle - last_muzzle),
+           last_facing_angle + t*d_angle);
     }
   }
+
+  last_muzzle = muzzle;
+  last_facing_angle = facing_angle;
 }
 
 xMATH::Float2
 EngCharacter::
 weapon_top() const noexcept {
-  Float2 adjust = xMATH::rotate(facing_unit_direction, Float2{0.0f, -1.0f});
   Float2 up_diff = skeleton[WEAPON] +
                    Float2{0.0f, (*images)[WEAPON].height()*0.5f};
-  return position + xMATH::rotate(up_diff, adjust);
+  return body().turned(-1).apply(up_diff);
+}
+
+xMATH::Transform2D
+EngCharacter::
+body() const noexcept {
+  return xMATH::Transform2D(facing_angle, facing_unit_direction, position);
+}
+
+xMATH::Transform2D
+EngCharacter::
+body(float alpha) const noexcept {
+  const Float2 at = prev_position + alpha*(position - prev_position);
+  if (alpha >= 1.0f || prev_facing_angle == facing_angle) {
+    return xMATH::Transform2D(facing_angle, facing_unit_direction, at);
+  }
+  return xMATH::Transform2D(prev_facing_angle +
+                            alpha*turn(prev_facing_angle, facing_angle), at);
+}
+
+EngSpriteCache::
+EngSpriteCache(GRAL::Screen *screen,
+               GRAL::Image (* const images)[EngCharacter::NUM_BODY_PIECES],
+               int num_phases)
+  : screen {screen},
+    pieces {images},
+    num_phases {num_phases},
+    corner {0.0f, 0.0f},
+    w {0},
+    h {0},
+    num_drawn {0}
+{
+  constexpr float DEG_TO_RAD {PI<float>()/180.0f};
+
+  // The box around every piece in every phase. Pieces are images pointing
+  // up, turned to point right, so their width is along y.
+  Float2 low {std::numeric_limits<float>::max()};
+  Float2 high {-std::numeric_limits<float>::max()};
+  for (int phase = 0; phase < num_phases; phase++) {
+    Float2 centers[EngCharacter::NUM_BODY_PIECES];
+    EngCharacter::pose(phase*360.0f/num_phases * DEG_TO_RAD, centers);
+    for (int i = 0; i < EngCharacter::NUM_BODY_PIECES; i++) {
+      const Float2 center = xMATH::rotate_quarters(centers[i], -1);
+      const Float2 half_size = 0.5f*Float2((*pieces)[i].height(),
+                                           (*pieces)[i].width());
+      low.x() = std::min(low.x(), center.x() - half_size.x());
+      low.y() = std::min(low.y(), center.y() - half_size.y());
+      high.x() = std::max(high.x(), center.x() + half_size.x());
+      high.y() = std::max(high.y(), center.y() + half_size.y());
+    }
+  }
+
+  // A pixel of margin, so the edges don't get cut by rounding.
+  corner = Float2(std::floor(low.x()) - 1.0f, std::floor(low.y()) - 1.0f);
+  w = int(std::ceil(high.x())) + 1 - int(corner.x());
+  h = int(std::ceil(high.y())) + 1 - int(corner.y());
+
+  // Drawn with plain blending, the poses' partly transparent edges would
+  // get their alpha applied twice: once when the pieces are drawn into them,
+  // and again when they're drawn. So they hold premultiplied colors instead.
+  if (screen->supports_render_targets() &&
+      screen->supports_blend_mode(xSDL::premultiplied_compose_blend_mode()) &&
+      screen->supports_blend_mode(xSDL::premultiplied_blend_mode()))
+  {
+    poses.resize(num_phases);
+  }
+}
+
+GRAL::Image*
+EngSpriteCache::
+pose(uint32_t anim_bouncing_ms) {
+  if (poses.empty()) {
+    return nullptr;
+  }
+
+  const int phase = EngCharacter::bouncing_degrees(anim_bouncing_ms)*
+                    num_phases/360;
+  std::unique_ptr<GRAL::Image> &img = poses[phase];
+  if (img) {
+    return img.get();
+  }
+  TRACE_Zone("EngSpriteCache::draw_pose");
+
+  constexpr float DEG_TO_RAD {PI<float>()/180.0f};
+
+  std::unique_ptr<GRAL::Image> drawn {new GRAL::Image(screen, w, h)};
+  Float2 centers[EngCharacter::NUM_BODY_PIECES];
+  EngCharacter::pose(phase*360.0f/num_phases * DEG_TO_RAD, centers);
+  {
+    GRAL::RenderTargetGuard target_guard(screen, drawn.get());
+
+    // From the character's frame to the image's.
+    const xMATH::Transform2D to_image(0.0f, Float2(1.0f, 0.0f), -corner);
+
+    // Back to front, as EngCharacter::render adds them.
+    for (int i = EngCharacter::NUM_BODY_PIECES - 1; i >= 0; i--) {
+      GRAL::Image *piece = (*pieces) + i;
+      GRAL::AlphaModGuard alpha_mod_guard(piece, 255);
+      GRAL::ColorModGuard color_mod_guard(piece, xSDL::WHITE);
+      GRAL::BlendModeGuard blend_mode_guard(
+        piece, xSDL::premultiplied_compose_blend_mode());
+      screen->draw_image_270(piece, centers[i], to_image);
+    }
+  }
+  drawn->set_blend_mode(xSDL::premultiplied_blend_mode());
+
+  img = std::move(drawn);
+  num_drawn++;
+  return img.get();
+}
+
+Float2
+EngSpriteCache::
+center() const noexcept {
+  return corner + 0.5f*Float2(w, h);
+}
+
+GRAL::Image
+(*EngSpriteCache::images() const noexcept)[EngCharacter::NUM_BODY_PIECES] {
+  return pieces;
+}
+
+void
+EngSpriteCache::
+invalidate() noexcept {
+  for (std::unique_ptr<GRAL::Image> &img : poses) {
+    img.reset();
+  }
+  num_drawn = 0;
+}
+
+int
+EngSpriteCache::
+poses_drawn() const noexcept {
+  return num_drawn;
+}
+
+size_t
+EngSpriteCache::
+bytes_reserved() const noexcept {
+  return size_t(num_drawn)*w*h*4;
+}
+
+size_t
+EngSpriteCache::
+bytes_budget() const noexcept {
+  return poses.size()*w*h*4;
 }
 
 /**
@@ -1,6 +1,10 @@
 #ifndef CHARACTER_HPP
 #define CHARACTER_HPP
 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 #include "Atlas.hpp"
 #include "xMath.hpp"
 #include "Graphical.hpp"
@@ -8,6 +12,8 @@
 
 namespace GAME {
 
+class EngSpriteCache;
+
 class EngCharacter {
 public:
   // These values have to match the order of ENG_* pieces in ATLAS.
@@ -25,10 +31,17 @@ public:
   static const xMATH::Float2
   skeleton[NUM_BODY_PIECES];
 
+  enum {
+    // After a stall, at most this many of the shots that were due are fired
+    // (the latest ones). The rest are dropped.
+    DEFAULT_MAX_CATCH_UP_SHOTS = 8
+  };
+
   EngCharacter(const xMATH::Float2 position,
                GRAL::Image (* const images)[NUM_BODY_PIECES],
                GRAL::Image *fire_particle,
-               float firing_freq_ms = 1.0f/50.0f) noexcept;
+               float firing_freq_ms = 1.0f/50.0f,
+               int max_catch_up_shots = DEFAULT_MAX_CATCH_UP_SHOTS) noexcept;
 
   /**
    * Sets the character facing so the weapon faces the given point.
@@ -69,12 +82,51 @@ public:
   void
   stop_firing() noexcept;
 
+  /**
+   * Adds the character's pieces to `sprites`, back to front. With a sprite
+   * cache in use, it's a single sprite instead.
+   *
+   * The character is drawn `alpha` (in [0, 1]) of the way from where it
+   * was before the last update to where it is now, facing in between too.
+   */
   void
-  render(GRAL::Screen *screen) noexcept;
+  render(GRAL::SpriteBatch *sprites, float alpha = 1.0f);
 
+  /**
+   * Makes render draw the character as one of the cache's composites, which
+   * must be made of the character's images. Null goes back to drawing it
+   * piece by piece.
+   */
+  void
+  use_sprite_cache(EngSpriteCache *cache) noexcept;
+
+  /**
+   * Writes into `pieces` where each piece's center is when the bouncing
+   * animation is at `bouncing_angle` (in radians), relative to the head and
+   * with the character facing up.
+   */
+  static void
+  pose(float bouncing_angle, xMATH::Float2 pieces[NUM_BODY_PIECES]) noexcept;
+
+  /**
+   * The bouncing animation's angle, in degrees, after it's run for
+   * `anim_bouncing_ms`.
+   */
+  static uint32_t
+  bouncing_degrees(uint32_t anim_bouncing_ms) noexcept;
+
+  /**
+   * Fires one shot from where the weapon is now.
+   */
   void
   fire(ParticlesSystem *particles, uint32_t ms_now) noexcept;
 
+  /**
+   * Moves the character over the last `dt_ms` ms, and fires the shots that
+   * were due in them. Each shot starts at the time it was due, from where
+   * the weapon was at that time: the weapon's position and angle are
+   * interpolated between the last update and this one.
+   */
   void
   update(ParticlesSystem *particles,
          uint32_t ms_now,
@@ -84,6 +136,20 @@ public:
   weapon_top() const noexcept;
 
 private:
+  /**
+   * Takes points from the character's frame (facing right, with the head at
+   * the origin) to the screen's. facing_unit_direction is the cosine and
+   * sine of facing_angle, so it takes no trigonometry.
+   */
+  xMATH::Transform2D
+  body() const noexcept;
+
+  /**
+   * Same, but `alpha` of the way from before the last update to now.
+   */
+  xMATH::Transform2D
+  body(float alpha) const noexcept;
+
   xMATH::Float2 facing_unit_direction;
   float facing_angle;
   xMATH::Float2 position;
@@ -93,12 +159,110 @@ private:
   float right;
 
   GRAL::Image (* const images)[NUM_BODY_PIECES];
+  EngSpriteCache *sprite_cache;
 
   uint32_t anim_bouncing_ms;
 
+  void
+  emit(ParticlesSystem *particles, uint32_t ms_start,
+       xMATH::Float2 muzzle, float angle) noexcept;
+
   uint32_t firing_since_ms;
   float firing_freq_ms;
   GRAL::Image *fire_particle;
+
+  // Shots fired (or dropped) since firing_since_ms.
+  uint32_t shots_fired;
+  int max_catch_up_shots;
+
+  // Where the weapon was and where it faced at the end of the last update.
+  xMATH::Float2 last_muzzle;
+  float last_facing_angle;
+
+  // Where the character was and where it faced at the start of the last
+  // update.
+  xMATH::Float2 prev_position;
+  float prev_facing_angle;
+};
+
+/**
+ * Engineers assembled from their pieces into a single image, one for each of
+ * a fixed number of phases of the bouncing animation. A character using the
+ * cache is drawn as one rotated image, at the pose of the phase nearest
+ * below its own.
+ *
+ * Each phase is drawn into a texture the first time it's asked for, so the
+ * texture memory held is at most bytes_budget(). Characters with the same
+ * images can share a cache.
+ */
+class EngSpriteCache {
+public:
+  enum {
+    DEFAULT_NUM_PHASES = 32
+  };
+
+  /**
+   * If the renderer can't draw into textures, or with premultiplied alpha
+   * blend modes (see xSDL::premultiplied_blend_mode), there are no poses:
+   * pose returns null and characters are drawn piece by piece.
+   */
+  EngSpriteCache(GRAL::Screen *screen,
+                 GRAL::Image (* const images)[EngCharacter::NUM_BODY_PIECES],
+                 int num_phases = DEFAULT_NUM_PHASES);
+
+  /**
+   * The image of the pose at `anim_bouncing_ms`, drawn now if it wasn't
+   * already. Its colors are premultiplied, and so is its blend mode. Null if
+   * the renderer can't draw poses (see the constructor).
+   */
+  GRAL::Image*
+  pose(uint32_t anim_bouncing_ms);
+
+  /**
+   * Where the center of the poses' images goes, relative to the head and
+   * with the character facing right (angle 0).
+   */
+  xMATH::Float2
+  center() const noexcept;
+
+  GRAL::Image (*images() const noexcept)[EngCharacter::NUM_BODY_PIECES];
+
+  /**
+   * Forgets the drawn poses, so they're drawn again when next asked for.
+   * Textures drawn into are lost when the renderer's device is reset (see
+   * SDL_RENDER_TARGETS_RESET), so call it then.
+   */
+  void
+  invalidate() noexcept;
+
+  int
+  poses_drawn() const noexcept;
+
+  /**
+   * Texture memory held by the poses drawn so far, and how much it gets to
+   * with every phase drawn.
+   */
+  size_t
+  bytes_reserved() const noexcept;
+
+  size_t
+  bytes_budget() const noexcept;
+
+private:
+  GRAL::Screen *screen;
+  GRAL::Image (* const pieces)[EngCharacter::NUM_BODY_PIECES];
+  int num_phases;
+
+  // Where the poses' images go: their bottom left corner relative to the
+  // head, with the character facing right, and their size. It's a box big
+  // enough for every phase.
+  xMATH::Float2 corner;
+  int w, h;
+
+  // One for each phase, null until drawn. Empty if the renderer can't draw
+  // into textures.
+  std::vector<std::unique_ptr<GRAL::Image>> poses;
+  int num_drawn;
 };
 
 } // end of game
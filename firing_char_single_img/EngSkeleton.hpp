@@ -10,9 +10,12 @@ namespace GAME {
 
 class EngSkeleton {
 public:
-  EngSkeleton(GRAL::Screen *screen, xSDL::Surface *atlas) {
+  /**
+   * The pieces are views of `atlas`, which must be atlas.png.
+   */
+  explicit EngSkeleton(const GRAL::Image *atlas) {
     for (int i = 0; i < ATLAS::ENG_NUM_PIECES; ++i) {
-      skeleton_buffer.emplace_back(screen, atlas,
+      skeleton_buffer.emplace_back(atlas,
                                    ATLAS::piece_geom(ATLAS::ENG_HEAD + i));
     }
   }
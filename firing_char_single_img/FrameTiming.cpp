@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "FrameTiming.hpp"
+
+namespace TIMING {
+
+static uint64_t
+ns_between(std::chrono::steady_clock::time_point from,
+           std::chrono::steady_clock::time_point to) noexcept
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(to - from).count();
+}
+
+FrameTimer::
+FrameTimer(const char * const *phase_names, int num_phases, size_t capacity)
+  : phase_names {phase_names},
+    num_phases {num_phases},
+    num_rows {1},
+    mask {0},
+    ring {},
+    frames_written {0},
+    frame_start {},
+    phase_start(num_phases),
+    frame_ns(num_phases + 1, 0)
+{
+  while (num_rows < capacity) {
+    num_rows *= 2;
+  }
+  mask = num_rows - 1;
+  ring.reset(new std::atomic<uint32_t>[num_rows*num_columns()]);
+}
+
+int
+FrameTimer::
+num_columns() const noexcept {
+  return num_phases + 1;
+}
+
+void
+FrameTimer::
+begin_frame() noexcept {
+  std::fill(frame_ns.begin(), frame_ns.end(), 0);
+  frame_start = Clock::now();
+}
+
+void
+FrameTimer::
+begin(int phase) noexcept {
+  phase_start[phase] = Clock::now();
+}
+
+void
+FrameTimer::
+end(int phase) noexcept {
+  frame_ns[phase] += ns_between(phase_start[phase], Clock::now());
+}
+
+void
+FrameTimer::
+end_frame() noexcept {
+  frame_ns[num_phases] = ns_between(frame_start, Clock::now());
+
+  const uint64_t frame = frames_written.load(std::memory_order_relaxed);
+  std::atomic<uint32_t> *row = ring.get() + (frame & mask)*num_columns();
+  // Pairs with the acquire loads of the row in snapshot: a reader that sees
+  // any of the values stored below then sees frames_written at frame or
+  // more when it reads it again, and so knows the row it read was being
+  // overwritten.
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int i = 0; i < num_columns(); i++) {
+    // Over 4 s is as good as 4 s here.
+    const uint32_t ns = std::min<uint64_t>(frame_ns[i], UINT32_MAX);
+    row[i].store(ns, std::memory_order_relaxed);
+  }
+  frames_written.store(frame + 1, std::memory_order_release);
+}
+
+uint64_t
+FrameTimer::
+snapshot(std::vector<uint32_t> *rows) const {
+  const uint64_t end = frames_written.load(std::memory_order_acquire);
+  uint64_t first = end > num_rows ? end - num_rows : 0;
+
+  rows->resize((end - first)*num_columns());
+  for (uint64_t frame = first; frame < end; frame++) {
+    const std::atomic<uint32_t> *row = ring.get() +
+                                       (frame & mask)*num_columns();
+    uint32_t *copy = rows->data() + (frame - first)*num_columns();
+    // Acquire, so the check below can't happen before these reads.
+    for (int i = 0; i < num_columns(); i++) {
+      copy[i] = row[i].load(std::memory_order_acquire);
+    }
+  }
+
+  // While frame n is being written (so before frames_written gets to n+1),
+  // frame n - num_rows is being overwritten. Rows from then on are intact.
+  const uint64_t now_written = frames_written.load(std::memory_order_relaxed);
+  if (now_written + 1 > first + num_rows) {
+    const uint64_t intact = std::min(now_written + 1 - num_rows, end);
+    rows->erase(rows->begin(),
+                rows->begin() + (intact - first)*num_columns());
+    first = intact;
+  }
+  return first;
+}
+
+PhaseSummary
+FrameTimer::
+summarize(int column) const {
+  std::vector<uint32_t> rows;
+  snapshot(&rows);
+
+  std::vector<uint32_t> ns;
+  ns.reserve(rows.size()/num_columns());
+  for (size_t i = column; i < rows.size(); i += num_columns()) {
+    ns.push_back(rows[i]);
+  }
+
+  PhaseSummary summary {};
+  if (ns.empty()) {
+    return summary;
+  }
+  std::sort(ns.begin(), ns.end());
+
+  uint64_t sum = 0;
+  for (uint32_t v : ns) {
+    sum += v;
+  }
+
+  auto percentile = [&ns](int p) -> uint64_t {
+    size_t rank = (ns.size()*p + 99)/100;
+    return ns[rank ? rank - 1 : 0];
+  };
+
+  summary.frames = ns.size();
+  summary.mean_ns = sum/ns.size();
+  summary.p50_ns = percentile(50);
+  summary.p95_ns = percentile(95);
+  summary.p99_ns = percentile(99);
+  summary.max_ns = ns.back();
+  return summary;
+}
+
+void
+FrameTimer::
+write_csv(std::ostream &out) const {
+  std::vector<uint32_t> rows;
+  const uint64_t first = snapshot(&rows);
+
+  out << "frame";
+  for (int i = 0; i < num_phases; i++) {
+    out << ',' << phase_names[i] << "_ns";
+  }
+  out << ",frame_ns\n";
+
+  const size_t num_frames = rows.size()/num_columns();
+  for (size_t frame = 0; frame < num_frames; frame++) {
+    out << first + frame;
+    for (int i = 0; i < num_columns(); i++) {
+      out << ',' << rows[frame*num_columns() + i];
+    }
+    out << '\n';
+  }
+}
+
+void
+FrameTimer::
+write_summary(std::ostream &out) const {
+  for (int i = 0; i < num_columns(); i++) {
+    const PhaseSummary s = summarize(i);
+    out << (i < num_phases ? phase_names[i] : "frame") << ": "
+        << s.frames << " frames, mean " << s.mean_ns
+        << " ns, p50 " << s.p50_ns
+        << ", p95 " << s.p95_ns
+        << ", p99 " << s.p99_ns
+        << ", max " << s.max_ns << ".\n";
+  }
+}
+
+} // end of timing
@@ -0,0 +1,146 @@
+#ifndef FRAME_TIMING_HPP
+#define FRAME_TIMING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+namespace TIMING {
+
+/**
+ * Distribution of a phase's time over the frames kept, in ns. Percentiles
+ * are nearest rank.
+ */
+struct PhaseSummary {
+  uint64_t frames;
+  uint64_t mean_ns;
+  uint64_t p50_ns;
+  uint64_t p95_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+};
+
+/**
+ * Times named phases of every frame, and keeps the timings of the last
+ * `capacity` frames. A phase can run any number of times in a frame (or not
+ * at all), and its time in the frame is the sum.
+ *
+ * Each frame's timings are a row in a ring, written by the thread running
+ * the frames without taking any lock. Snapshots can be taken from any thread
+ * at the same time: rows overwritten while they're being read are left out.
+ */
+class FrameTimer {
+public:
+  enum : size_t {
+    // About two minutes at 60 frames per second.
+    DEFAULT_CAPACITY = size_t(1) << 13
+  };
+
+  /**
+   * `phase_names` must outlive the timer. String literals will do. The
+   * capacity is rounded up to a power of 2.
+   */
+  FrameTimer(const char * const *phase_names, int num_phases,
+             size_t capacity = DEFAULT_CAPACITY);
+
+  FrameTimer(const FrameTimer&) = delete;
+  FrameTimer& operator=(const FrameTimer&) = delete;
+
+  void
+  begin_frame() noexcept;
+
+  void
+  begin(int phase) noexcept;
+
+  void
+  end(int phase) noexcept;
+
+  /**
+   * Adds the frame's timings to the ring. Besides the phases, the whole
+   * frame's time, from begin_frame, is kept too.
+   */
+  void
+  end_frame() noexcept;
+
+  /**
+   * Columns of a row: one per phase, then the whole frame.
+   */
+  int
+  num_columns() const noexcept;
+
+  /**
+   * Copies the rows of the frames kept into `rows`, oldest first, and returns
+   * the number of the first one (frames are numbered from 0).
+   */
+  uint64_t
+  snapshot(std::vector<uint32_t> *rows) const;
+
+  /**
+   * Summary of column `column` of the frames kept.
+   */
+  PhaseSummary
+  summarize(int column) const;
+
+  /**
+   * Writes a header, then a line per frame kept with its number and its
+   * time (in ns) in each phase and in total.
+   */
+  void
+  write_csv(std::ostream &out) const;
+
+  /**
+   * Writes a line per phase, and one for the whole frame, with its summary.
+   */
+  void
+  write_summary(std::ostream &out) const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  const char * const *phase_names;
+  int num_phases;
+
+  // Rows of num_columns() values each. Their number is a power of 2, and the
+  // mask is it minus 1.
+  size_t num_rows, mask;
+  std::unique_ptr<std::atomic<uint32_t>[]> ring;
+
+  // Rows written so far. Row i is in slot i & mask.
+  std::atomic<uint64_t> frames_written;
+
+  // The frame being timed. Only touched by the thread running the frames.
+  Clock::time_point frame_start;
+  std::vector<Clock::time_point> phase_start;
+  std::vector<uint64_t> frame_ns;
+};
+
+/**
+ * Times a phase for as long as it lives.
+ */
+class PhaseGuard {
+public:
+  PhaseGuard(FrameTimer *timer, int phase) noexcept
+    : timer {timer}, phase {phase}
+  {
+    timer->begin(phase);
+  }
+
+  ~PhaseGuard() {
+    timer->end(phase);
+  }
+
+  PhaseGuard(const PhaseGuard&) = delete;
+  PhaseGuard& operator=(const PhaseGuard&) = delete;
+
+private:
+  FrameTimer *timer;
+  int phase;
+};
+
+} // end of timing
+
+#endif
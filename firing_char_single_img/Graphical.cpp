@@ -1,6 +1,10 @@
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
 #include <utility>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "xMath.hpp"
 #include "xSDL.hpp"
@@ -9,17 +13,31 @@
 
 using xMATH::PI;
 using xMATH::Float2;
+using xMATH::Transform2D;
 
 namespace GRAL {
 
+static uint32_t next_image_id = 0;
+
 Image::
 Image(Image&& src) noexcept
-  : tex{std::move(src.tex)}, w{src.w}, h{src.h}
+  : tex{std::move(src.tex)}, region{src.region},
+    uv_min{src.uv_min}, uv_max{src.uv_max},
+    tex_w{src.tex_w}, tex_h{src.tex_h}, w{src.w}, h{src.h},
+    alpha_mod{src.alpha_mod}, color_mod{src.color_mod},
+    blend_mode{src.blend_mode}, id{src.id}
 {}
 
 Image::
 Image(Screen *screen, xSDL::Surface *surf)
-  : tex{screen->rend, surf}, w{surf->width()}, h{surf->height()}
+  : tex{std::make_shared<xSDL::Texture>(screen->rend, surf)},
+    region{0, 0, surf->width(), surf->height()},
+    uv_min{0.0f, 0.0f}, uv_max{1.0f, 1.0f},
+    tex_w{surf->width()}, tex_h{surf->height()},
+    w{surf->width()}, h{surf->height()},
+    alpha_mod{tex->get_alpha_mod()}, color_mod{tex->get_color_mod()},
+    blend_mode{tex->get_blend_mode()},
+    id{next_image_id++}
 {}
 
 Image::
@@ -37,13 +55,53 @@ Image(Screen *screen, xSDL::Surface&& surf, const xSDL::Rect &region)
   : Image{screen, &surf, region}
 {}
 
+Image::
+Image(const Image *atlas, const xSDL::Rect &region)
+  : tex{atlas->tex},
+    region{atlas->region.x + region.x, atlas->region.y + region.y,
+           region.w, region.h},
+    uv_min{}, uv_max{},
+    tex_w{atlas->tex_w}, tex_h{atlas->tex_h},
+    w{region.w}, h{region.h},
+    alpha_mod{atlas->alpha_mod}, color_mod{atlas->color_mod},
+    blend_mode{atlas->blend_mode},
+    id{atlas->id}
+{
+  SDL_assert(region.x >= 0 && region.y >= 0 &&
+             region.x + region.w <= atlas->w &&
+             region.y + region.h <= atlas->h);
+  uv_min = Float2(float(this->region.x)/tex_w, float(this->region.y)/tex_h);
+  uv_max = uv_min + Float2(float(w)/tex_w, float(h)/tex_h);
+}
+
+Image::
+Image(Screen *screen, int width, int height)
+  : tex{std::make_shared<xSDL::Texture>(screen->rend, width, height)},
+    region{0, 0, width, height},
+    uv_min{0.0f, 0.0f}, uv_max{1.0f, 1.0f},
+    tex_w{width}, tex_h{height},
+    w{width}, h{height},
+    alpha_mod{tex->get_alpha_mod()}, color_mod{tex->get_color_mod()},
+    blend_mode{tex->get_blend_mode()},
+    id{next_image_id++}
+{}
+
 Image&
 Image::
 operator=(Image&& src) noexcept {
   if (&src != this) {
     tex = std::move(src.tex);
+    region = src.region;
+    uv_min = src.uv_min;
+    uv_max = src.uv_max;
+    tex_w = src.tex_w;
+    tex_h = src.tex_h;
     w = src.w;
     h = src.h;
+    alpha_mod = src.alpha_mod;
+    color_mod = src.color_mod;
+    blend_mode = src.blend_mode;
+    id = src.id;
   }
   return *this;
 }
@@ -80,37 +138,47 @@ center_for_top_at(Float2 top, Float2 unit_direction) noexcept {
 void
 Image::
 set_alpha_mod(uint8_t alpha_mod) {
-  tex.set_alpha_mod(alpha_mod);
+  this->alpha_mod = alpha_mod;
 }
 
 void
 Image::
 set_color_mod(xSDL::Color color_mod) {
-  tex.set_color_mod(color_mod);
+  // Only r, g and b make up the color mod.
+  this->color_mod = xSDL::Color(color_mod.r, color_mod.g, color_mod.b);
 }
 
 void
 Image::
 set_blend_mode(xSDL::BlendMode blend_mode) {
-  tex.set_blend_mode(blend_mode);
+  this->blend_mode = blend_mode;
 }
 
 uint8_t
 Image::
 get_alpha_mod() const {
-  return tex.get_alpha_mod();
+  return alpha_mod;
 }
 
 xSDL::Color
 Image::
 get_color_mod() const {
-  return tex.get_color_mod();
+  return color_mod;
 }
 
 xSDL::BlendMode
 Image::
 get_blend_mode() const {
-  return tex.get_blend_mode();
+  return blend_mode;
+}
+
+void
+Image::
+bind() const {
+  // These don't call into SDL when nothing changes.
+  tex->set_blend_mode(blend_mode);
+  tex->set_alpha_mod(alpha_mod);
+  tex->set_color_mod(color_mod);
 }
 
 int
@@ -125,12 +193,21 @@ height() const noexcept {
   return h;
 }
 
+bool
+Image::
+shares_texture_with(const Image *other) const noexcept {
+  return tex == other->tex;
+}
+
 Screen::Screen(xSDL::Renderer *rend, int width, int height) noexcept
-  : rend(rend), w(width), h(height)
+  : rend(rend), w(width), h(height), queue()
 {}
 
 Screen::Screen(Screen&& src) noexcept
-  : rend(std::move(src.rend)), w(src.w), h(src.h)
+  : rend(std::move(src.rend)), w(src.w), h(src.h),
+    quad_indices(std::move(src.quad_indices)),
+    queue(std::move(src.queue)),
+    static_layers(std::move(src.static_layers))
 {}
 
 Screen&
@@ -140,6 +217,9 @@ operator=(Screen&& src) noexcept {
     rend = std::move(src.rend);
     w = src.w;
     h = src.h;
+    quad_indices = std::move(src.quad_indices);
+    queue = std::move(src.queue);
+    static_layers = std::move(src.static_layers);
   }
   return *this;
 }
@@ -150,18 +230,353 @@ load_image(const char *file_name) {
   return Image(this, xIMG::load(file_name));
 }
 
+std::vector<Image>
+Screen::
+load_images(WORK::Pool *pool, const char * const *file_names,
+            int num_files)
+{
+  xIMG::AsyncLoad loads {pool, file_names, num_files};
+  std::vector<Image> images;
+  images.reserve(num_files);
+  for (int i = 0; i < num_files; i++) {
+    images.emplace_back(this, loads.take(i));
+  }
+  return images;
+}
+
+/**
+ * Position of blend modes in the queue's sort order. It has to fit in 4 bits.
+ */
+static uint64_t
+blend_mode_rank(xSDL::BlendMode mode) noexcept {
+  switch (mode) {
+    case SDL_BLENDMODE_NONE:
+      return 0;
+    case SDL_BLENDMODE_BLEND:
+      return 1;
+    case SDL_BLENDMODE_ADD:
+      return 2;
+    case SDL_BLENDMODE_MOD:
+      return 3;
+    default:
+      return 15;
+  }
+}
+
+/**
+ * Sorts the keys with a least significant digit radix sort, one byte at a
+ * time. Bytes that are the same in every key (e.g. the layer, if only one is
+ * used) are skipped.
+ */
+static void
+radix_sort(std::vector<uint64_t> &keys, std::vector<uint64_t> &scratch) {
+  const size_t n = keys.size();
+  if (n < 2) {
+    return;
+  }
+
+  scratch.resize(n);
+  uint64_t *src = keys.data();
+  uint64_t *dest = scratch.data();
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    size_t offsets[256] = {};
+    for (size_t i = 0; i < n; i++) {
+      offsets[(src[i] >> shift) & 0xff]++;
+    }
+    if (offsets[(src[0] >> shift) & 0xff] == n) {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (size_t &count : offsets) {
+      const size_t byte_count = count;
+      count = offset;
+      offset += byte_count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      dest[offsets[(src[i] >> shift) & 0xff]++] = src[i];
+    }
+    std::swap(src, dest);
+  }
+
+  if (src != keys.data()) {
+    keys.swap(scratch);
+  }
+}
+
+void
+Screen::
+begin_queued() noexcept {
+  queue.active = true;
+}
+
+void
+Screen::
+set_layer(uint8_t layer) noexcept {
+  queue.layer = layer;
+}
+
+void
+Screen::
+enqueue(const DrawCommand &cmd) {
+  const uint64_t index = queue.commands.size();
+  const uint64_t image_id = cmd.img ? (cmd.img->id & 0xfffff) : 0;
+
+  queue.keys.push_back(uint64_t(queue.layer) << 56 |
+                       blend_mode_rank(cmd.blend_mode) << 52 |
+                       image_id << 32 |
+                       index);
+  try {
+    queue.commands.push_back(cmd);
+  }
+  catch (...) {
+    queue.keys.pop_back();
+    throw;
+  }
+}
+
+void
+Screen::
+end_queued() {
+  radix_sort(queue.keys, queue.sort_scratch);
+
+  auto clear_queue = [this]() noexcept {
+    queue.commands.clear();
+    queue.keys.clear();
+    queue.vertices.clear();
+    queue.layer = 0;
+    queue.active = false;
+    release_dirty_layers();
+  };
+
+  // Not in queued mode anymore, or we'd queue what we're replaying.
+  queue.active = false;
+
+  try {
+    for (uint64_t key : queue.keys) {
+      const DrawCommand &cmd = queue.commands[key & 0xffffffff];
+
+      // The texture gets the state recorded with the draw. The image's own
+      // state is left alone. These don't call into SDL when nothing changes.
+      if (cmd.img) {
+        cmd.img->tex->set_blend_mode(cmd.blend_mode);
+        cmd.img->tex->set_alpha_mod(cmd.alpha_mod);
+        cmd.img->tex->set_color_mod(cmd.color);
+      }
+
+      switch (cmd.kind) {
+        case DrawCommand::COPY: {
+          const xSDL::Rect dest = cmd.copy.rect;
+          const xSDL::Rect src = cmd.copy.src;
+          rend->copy(cmd.img->tex.get(), &src, &dest,
+                     cmd.copy.angle_degrees, nullptr, cmd.flip);
+          break;
+        }
+        case DrawCommand::QUADS:
+          rend->geometry(cmd.img->tex.get(),
+                         queue.vertices.data() + cmd.quads.first_vertex,
+                         cmd.quads.num_quads*4,
+                         indices_for_quads(cmd.quads.num_quads),
+                         cmd.quads.num_quads*6);
+          break;
+        case DrawCommand::FILL:
+          rend->set_draw_color(cmd.color);
+          rend->fill_rectangle(cmd.copy.rect);
+          break;
+        case DrawCommand::LINE:
+          rend->set_draw_color(cmd.color);
+          rend->draw_line(cmd.line.x1, cmd.line.y1, cmd.line.x2, cmd.line.y2);
+          break;
+      }
+    }
+  }
+  catch (...) {
+    clear_queue();
+    throw;
+  }
+
+  clear_queue();
+}
+
 void
 Screen::
 fill_square(xMATH::Float2 center, float side, xSDL::Color color) {
-  rend->set_draw_color(color);
   int side_i = static_cast<int>(side);
   xSDL::Rect rect = {static_cast<int>(center.x() - side/2.0f),
                      static_cast<int>(h - 1.0f - center.y() - side/2.0f),
                      side_i,
                      side_i};
+
+  if (queue.active) {
+    DrawCommand cmd;
+    cmd.kind = DrawCommand::FILL;
+    cmd.alpha_mod = 255;
+    cmd.flip = SDL_FLIP_NONE;
+    cmd.blend_mode = SDL_BLENDMODE_NONE;
+    cmd.color = color;
+    cmd.img = nullptr;
+    cmd.copy.rect = rect;
+    cmd.copy.src = xSDL::Rect(0, 0, 0, 0);
+    cmd.copy.angle_degrees = 0.0f;
+    enqueue(cmd);
+    return;
+  }
+
+  rend->set_draw_color(color);
   rend->fill_rectangle(rect);
 }
 
+void
+Screen::
+draw_line(xMATH::Float2 from, xMATH::Float2 to, xSDL::Color color) {
+  const int x1 = static_cast<int>(from.x());
+  const int y1 = static_cast<int>(h - 1.0f - from.y());
+  const int x2 = static_cast<int>(to.x());
+  const int y2 = static_cast<int>(h - 1.0f - to.y());
+
+  if (queue.active) {
+    DrawCommand cmd;
+    cmd.kind = DrawCommand::LINE;
+    cmd.alpha_mod = 255;
+    cmd.flip = SDL_FLIP_NONE;
+    cmd.blend_mode = SDL_BLENDMODE_NONE;
+    cmd.color = color;
+    cmd.img = nullptr;
+    cmd.line.x1 = x1;
+    cmd.line.y1 = y1;
+    cmd.line.x2 = x2;
+    cmd.line.y2 = y2;
+    enqueue(cmd);
+    return;
+  }
+
+  rend->set_draw_color(color);
+  rend->draw_line(x1, y1, x2, y2);
+}
+
+void
+Screen::
+static_layer(const char *name, LayerFn draw, void *ctx) {
+  size_t i = 0;
+  for (; i < static_layers.size(); i++) {
+    if (static_layers[i].name == name) {
+      break;
+    }
+  }
+  if (i == static_layers.size()) {
+    static_layers.push_back(StaticLayer{name, nullptr, false});
+  }
+
+  if (!rend->supports_targets()) {
+    draw(ctx, this);
+    return;
+  }
+
+  StaticLayer &layer = static_layers[i];
+  if (!layer.img || layer.dirty) {
+    std::unique_ptr<Image> img {new Image(this, w, h)};
+    {
+      RenderTargetGuard target_guard(this, img.get());
+      draw(ctx, this);
+    }
+    if (layer.img) {
+      // Dirty, and still drawn by queued commands.
+      queue.retired_layers.push_back(std::move(layer.img));
+    }
+    layer.img = std::move(img);
+    layer.dirty = false;
+  }
+
+  copy_image(layer.img.get(), nullptr, xSDL::Rect(0, 0, w, h),
+             0.0, SDL_FLIP_NONE);
+}
+
+void
+Screen::
+dirty(StaticLayer *layer) noexcept {
+  // Queued commands hold a plain pointer to the image they draw. The queue
+  // may also be suspended by a RenderTargetGuard, so it's its commands that
+  // tell, not queue.active.
+  if (queue.commands.empty()) {
+    layer->img.reset();
+  }
+  else {
+    layer->dirty = true;
+  }
+}
+
+void
+Screen::
+release_dirty_layers() noexcept {
+  queue.retired_layers.clear();
+  for (StaticLayer &layer : static_layers) {
+    if (layer.dirty) {
+      layer.img.reset();
+      layer.dirty = false;
+    }
+  }
+}
+
+void
+Screen::
+dirty_static_layer(const char *name) noexcept {
+  for (StaticLayer &layer : static_layers) {
+    if (layer.name == name) {
+      dirty(&layer);
+    }
+  }
+}
+
+void
+Screen::
+dirty_static_layers() noexcept {
+  for (StaticLayer &layer : static_layers) {
+    dirty(&layer);
+  }
+}
+
+void
+Screen::
+resize(int width, int height) noexcept {
+  if (width != w || height != h) {
+    w = width;
+    h = height;
+    dirty_static_layers();
+  }
+}
+
+void
+Screen::
+copy_image(Image *img, const xSDL::Rect *src, const xSDL::Rect &dest,
+           double angle_degrees, xSDL::RenderFlip flip)
+{
+  // From the image's pixels to its texture's.
+  xSDL::Rect tex_src = img->region;
+  if (src) {
+    tex_src = xSDL::Rect(img->region.x + src->x, img->region.y + src->y,
+                         src->w, src->h);
+  }
+
+  if (queue.active) {
+    DrawCommand cmd;
+    cmd.kind = DrawCommand::COPY;
+    cmd.alpha_mod = img->get_alpha_mod();
+    cmd.flip = flip;
+    cmd.blend_mode = img->get_blend_mode();
+    cmd.color = img->get_color_mod();
+    cmd.img = img;
+    cmd.copy.rect = dest;
+    cmd.copy.src = tex_src;
+    cmd.copy.angle_degrees = angle_degrees;
+    enqueue(cmd);
+    return;
+  }
+
+  img->bind();
+  rend->copy(img->tex.get(), &tex_src, &dest, angle_degrees, nullptr, flip);
+}
+
 /**
  * Draw the image with its CENTER at x,y and rotated by ANGLE around its
  * center. You should also specify x,y from left->right and bottom->up.
@@ -189,8 +604,7 @@ draw_image(Image *img, xMATH::Float2 center,
   const xSDL::Rect dest_rect = {static_cast<int>(x), static_cast<int>(y),
                                 img->width(), img->height()};
 
-  rend->copy(&img->tex, nullptr, &dest_rect, -angle*RAD_TO_DEG, nullptr,
-             flip);
+  copy_image(img, nullptr, dest_rect, -angle*RAD_TO_DEG, flip);
 }
 
 void
@@ -280,6 +694,108 @@ draw_image_270(Image *img, xMATH::Float2 center,
              flip);
 }
 
+void
+Screen::
+draw_image(Image *img, xMATH::Float2 center,
+           const xMATH::Transform2D &transform, xSDL::RenderFlip flip)
+{
+  draw_image(img, transform.apply(center), transform.angle, flip);
+}
+
+void
+Screen::
+draw_image_90(Image *img, xMATH::Float2 center,
+              const xMATH::Transform2D &transform, xSDL::RenderFlip flip)
+{
+  const xMATH::Transform2D turned = transform.turned(1);
+  draw_image(img, turned.apply(center), turned.angle, flip);
+}
+
+void
+Screen::
+draw_image_180(Image *img, xMATH::Float2 center,
+               const xMATH::Transform2D &transform, xSDL::RenderFlip flip)
+{
+  const xMATH::Transform2D turned = transform.turned(2);
+  draw_image(img, turned.apply(center), turned.angle, flip);
+}
+
+void
+Screen::
+draw_image_270(Image *img, xMATH::Float2 center,
+               const xMATH::Transform2D &transform, xSDL::RenderFlip flip)
+{
+  const xMATH::Transform2D turned = transform.turned(-1);
+  draw_image(img, turned.apply(center), turned.angle, flip);
+}
+
+void
+Screen::
+draw_image_region(Image *img, const xSDL::Rect &region, xMATH::Float2 center,
+                  xSDL::RenderFlip flip)
+{
+  const float y = (h - 1.0f - center.y()) - region.h/2.0f;
+  const float x = center.x() - region.w/2.0f;
+  const xSDL::Rect dest_rect = {static_cast<int>(x), static_cast<int>(y),
+                                region.w, region.h};
+
+  copy_image(img, &region, dest_rect, 0.0, flip);
+}
+
+const int*
+Screen::
+indices_for_quads(int num_quads) {
+  int quads_indexed = quad_indices.size()/6;
+  if (quads_indexed < num_quads) {
+    quad_indices.resize(num_quads*6);
+    for (int i = quads_indexed; i < num_quads; i++) {
+      int *idx = quad_indices.data() + i*6;
+      const int v = i*4;
+      idx[0] = v;
+      idx[1] = v + 1;
+      idx[2] = v + 2;
+      idx[3] = v;
+      idx[4] = v + 2;
+      idx[5] = v + 3;
+    }
+  }
+  return quad_indices.data();
+}
+
+void
+Screen::
+draw_quads(Image *img, const xSDL::Vertex *vertices, int num_quads) {
+  if (num_quads <= 0) {
+    return;
+  }
+
+  if (queue.active) {
+    DrawCommand cmd;
+    cmd.kind = DrawCommand::QUADS;
+    cmd.alpha_mod = img->get_alpha_mod();
+    cmd.flip = SDL_FLIP_NONE;
+    cmd.blend_mode = img->get_blend_mode();
+    cmd.color = img->get_color_mod();
+    cmd.img = img;
+    cmd.quads.first_vertex = queue.vertices.size();
+    cmd.quads.num_quads = num_quads;
+    queue.vertices.insert(queue.vertices.end(), vertices,
+                          vertices + num_quads*4);
+    try {
+      enqueue(cmd);
+    }
+    catch (...) {
+      queue.vertices.resize(cmd.quads.first_vertex);
+      throw;
+    }
+    return;
+  }
+
+  img->bind();
+  rend->geometry(img->tex.get(), vertices, num_quads*4,
+                 indices_for_quads(num_quads), num_quads*6);
+}
+
 int
 Screen::
 width() const noexcept {
@@ -292,5 +808,323 @@ height() const noexcept {
   return h;
 }
 
+bool
+Screen::
+supports_render_targets() const noexcept {
+  return rend->supports_targets();
+}
+
+bool
+Screen::
+supports_blend_mode(xSDL::BlendMode mode) {
+  return rend->supports_blend_mode(mode);
+}
+
+RenderTargetGuard::
+RenderTargetGuard(Screen *screen, Image *target, bool clear)
+  : screen {screen}, restore_w {screen->w}, restore_h {screen->h},
+    restore_queued {screen->queue.active}
+{
+  // Drawing into part of a texture isn't supported.
+  SDL_assert(target->w == target->tex_w && target->h == target->tex_h);
+  screen->rend->set_target(target->tex.get());
+  try {
+    if (clear) {
+      screen->rend->set_draw_color(xSDL::Color(0, 0, 0, 0));
+      screen->rend->clear();
+    }
+  }
+  catch (...) {
+    try {
+      screen->rend->set_target(nullptr);
+    }
+    catch (...) {
+      // The original error is the one worth reporting.
+    }
+    throw;
+  }
+  screen->w = target->w;
+  screen->h = target->h;
+  screen->queue.active = false;
+}
+
+RenderTargetGuard::
+~RenderTargetGuard() {
+  screen->w = restore_w;
+  screen->h = restore_h;
+  screen->queue.active = restore_queued;
+  try {
+    screen->rend->set_target(nullptr);
+  }
+  catch (...) {
+    // We do nothing if this fail.
+  }
+}
+
+/**
+ * Throws std::invalid_argument unless there's at least one angle. It checks
+ * the num_angles member, which is initialized before the ones computed from
+ * it.
+ */
+static int
+checked_num_angles(int num_angles) {
+  if (num_angles <= 0) {
+    throw std::invalid_argument("PreRotatedImage needs at least one angle");
+  }
+  return num_angles;
+}
+
+PreRotatedImage::
+PreRotatedImage(Screen *screen, Image *img, int num_angles, float tolerance,
+                Rendering rendering)
+  : screen {screen},
+    img {img},
+    num_angles {checked_num_angles(num_angles)},
+    step {2.0f*PI<float>()/num_angles},
+    tolerance {tolerance < 0.0f ? PI<float>()/num_angles : tolerance},
+    side {0},
+    columns {0},
+    atlas {},
+    rendered(num_angles, false),
+    counters {}
+{
+  // Room for the image at any angle, and a pixel of margin all around so
+  // neighbouring cells don't bleed into each other.
+  const float diagonal = std::sqrt(float(img->width())*img->width() +
+                                   float(img->height())*img->height());
+  side = int(std::ceil(diagonal)) + 2;
+  columns = int(std::ceil(std::sqrt(float(num_angles))));
+  const int rows = (num_angles + columns - 1)/columns;
+
+  if (!screen->supports_render_targets()) {
+    return;
+  }
+
+  atlas.reset(new Image(screen, columns*side, rows*side));
+  {
+    RenderTargetGuard target_guard(screen, atlas.get());
+  }
+  counters.bytes_reserved = size_t(atlas->width())*atlas->height()*4;
+
+  if (rendering == AT_ONCE) {
+    for (int k = 0; k < num_angles; k++) {
+      render_angle(k);
+    }
+  }
+}
+
+xSDL::Rect
+PreRotatedImage::
+cell(int k) const noexcept {
+  return xSDL::Rect((k % columns)*side, (k / columns)*side, side, side);
+}
+
+void
+PreRotatedImage::
+render_angle(int k) {
+  const xSDL::Rect rect = cell(k);
+
+  RenderTargetGuard target_guard(screen, atlas.get(), false);
+
+  // The cell may hold an angle rendered before the atlas was invalidated,
+  // or garbage if the renderer's targets were reset.
+  screen->fill_square(Float2(rect.x + side*0.5f,
+                             atlas->height() - 1.0f - rect.y - side*0.5f),
+                      side, xSDL::Color(0, 0, 0, 0));
+
+  // The image's pixels go into the cell as they are, to be blended when the
+  // cell is drawn.
+  BlendModeGuard blend_mode_guard(img, SDL_BLENDMODE_NONE);
+  AlphaModGuard alpha_mod_guard(img, 255);
+  ColorModGuard color_mod_guard(img, xSDL::WHITE);
+  screen->draw_image(img,
+                     Float2(rect.x + side*0.5f,
+                            atlas->height() - 1.0f - rect.y - side*0.5f),
+                     k*step);
+
+  rendered[k] = true;
+  counters.angles_rendered++;
+}
+
+void
+PreRotatedImage::
+draw(Float2 center, float angle, xSDL::RenderFlip flip) {
+  // SDL flips before rotating. Flipping along one axis and then rotating is
+  // the same as rotating the other way and then flipping, and flipping along
+  // both axes is a half turn.
+  float cell_angle = angle;
+  xSDL::RenderFlip cell_flip = flip;
+  if (flip == (SDL_FLIP_HORIZONTAL | SDL_FLIP_VERTICAL)) {
+    cell_angle += PI<float>();
+    cell_flip = SDL_FLIP_NONE;
+  }
+  else if (flip != SDL_FLIP_NONE) {
+    cell_angle = -cell_angle;
+  }
+
+  const float steps = cell_angle/step;
+  const float nearest = std::round(steps);
+  if (!atlas || std::abs(steps - nearest)*step > tolerance) {
+    counters.misses++;
+    screen->draw_image(img, center, angle, flip);
+    return;
+  }
+
+  int k = int(nearest) % num_angles;
+  if (k < 0) {
+    k += num_angles;
+  }
+  if (!rendered[k]) {
+    render_angle(k);
+  }
+
+  // The cells are drawn as the image would be.
+  atlas->set_blend_mode(img->get_blend_mode());
+  atlas->set_alpha_mod(img->get_alpha_mod());
+  atlas->set_color_mod(img->get_color_mod());
+
+  counters.hits++;
+  screen->draw_image_region(atlas.get(), cell(k), center, cell_flip);
+}
+
+void
+PreRotatedImage::
+invalidate() noexcept {
+  std::fill(rendered.begin(), rendered.end(), false);
+  counters.angles_rendered = 0;
+}
+
+const PreRotationStats&
+PreRotatedImage::
+stats() const noexcept {
+  return counters;
+}
+
+SpriteBatch::
+SpriteBatch(Screen *screen) noexcept
+  : screen {screen}
+{}
+
+SpriteBatch::Placed
+SpriteBatch::
+place(const Sprite &sprite) noexcept {
+  // The quarter turns of draw_image_90, _180 and _270 are exact, and don't
+  // need any sine or cosine.
+  Float2 cos_sin {1.0f, 0.0f};
+  if (sprite.angle != 0.0f) {
+    cos_sin = Float2(std::cos(sprite.angle), std::sin(sprite.angle));
+  }
+  cos_sin = rotate_quarters(cos_sin, sprite.flags & 3);
+
+  const Float2 center = sprite.rot_center +
+                        rotate(sprite.center - sprite.rot_center, cos_sin);
+  return {sprite.img, center, cos_sin, sprite.color,
+          uint8_t(sprite.flags & ~3)};
+}
+
+void
+SpriteBatch::
+add(const Sprite &sprite) {
+  sprites.push_back(place(sprite));
+}
+
+void
+SpriteBatch::
+add(const Sprite *sprites, size_t num_sprites) {
+  for (size_t i = 0; i < num_sprites; i++) {
+    add(sprites[i]);
+  }
+}
+
+void
+SpriteBatch::
+add(const Sprite &sprite, const Transform2D &transform) {
+  Placed placed = place(sprite);
+  placed.center = transform.apply(placed.center);
+  placed.cos_sin = transform.apply_rotation(placed.cos_sin);
+  sprites.push_back(placed);
+}
+
+void
+SpriteBatch::
+add(const Sprite *sprites, size_t num_sprites, const Transform2D &transform) {
+  for (size_t i = 0; i < num_sprites; i++) {
+    add(sprites[i], transform);
+  }
+}
+
+void
+SpriteBatch::
+clear() noexcept {
+  sprites.clear();
+}
+
+void
+SpriteBatch::
+sprite_quad(const Placed &sprite, xSDL::Vertex quad[4]) const noexcept {
+  screen->image_quad(sprite.img, sprite.center, sprite.cos_sin, sprite.color,
+                     quad);
+
+  // Flipping the texture coordinates flips the image before it's rotated,
+  // as SDL_RenderCopyEx does.
+  if (sprite.flags & Sprite::FLIP_HORIZONTAL) {
+    std::swap(quad[0].tex_coord.x, quad[1].tex_coord.x);
+    std::swap(quad[3].tex_coord.x, quad[2].tex_coord.x);
+  }
+  if (sprite.flags & Sprite::FLIP_VERTICAL) {
+    std::swap(quad[0].tex_coord.y, quad[3].tex_coord.y);
+    std::swap(quad[1].tex_coord.y, quad[2].tex_coord.y);
+  }
+}
+
+void
+SpriteBatch::
+draw(Order draw_order) {
+  const size_t n = sprites.size();
+  if (n == 0) {
+    return;
+  }
+
+  order.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  if (draw_order == BY_IMAGE) {
+    std::stable_sort(order.begin(), order.end(),
+                     [this](uint32_t a, uint32_t b) {
+                       const Image *img_a = sprites[a].img;
+                       const Image *img_b = sprites[b].img;
+                       if (img_a->tex != img_b->tex) {
+                         return img_a->tex < img_b->tex;
+                       }
+                       return img_a->blend_mode < img_b->blend_mode;
+                     });
+  }
+
+  vertices.resize(n*4);
+  for (size_t i = 0; i < n; i++) {
+    sprite_quad(sprites[order[i]], vertices.data() + i*4);
+  }
+
+  size_t i = 0;
+  while (i < n) {
+    Image *img = sprites[order[i]].img;
+    const size_t first = i;
+    for (; i < n; i++) {
+      const Image *next = sprites[order[i]].img;
+      if (next->tex != img->tex || next->blend_mode != img->blend_mode) {
+        break;
+      }
+    }
+
+    // Color and alpha are in the vertices.
+    AlphaModGuard alpha_mod_guard(img, 255);
+    ColorModGuard color_mod_guard(img, xSDL::WHITE);
+    screen->draw_quads(img, vertices.data() + first*4, i - first);
+  }
+
+  sprites.clear();
+}
+
 
 } // end of gral
@@ -59,26 +59,61 @@
  */
 
 #include <cmath>
+#include <cstdint>
+#include <memory>
 #include <utility>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "xMath.hpp"
 #include "xSDL.hpp"
 #include "xSDL_image.hpp"
+#include "WorkerPool.hpp"
 
 namespace GRAL {
 
 class Screen;
 
+/**
+ * Something to draw: a texture, or a region of one.
+ *
+ * Each image has its own alpha mod, color mod and blend mode, which are
+ * given to the texture when the image is drawn. So images sharing a texture
+ * (see the view constructor) don't see each other's state.
+ */
 class Image {
   friend class Screen;
+  friend class RenderTargetGuard;
+  friend class SpriteBatch;
 
 public:
   Image(Screen *Screen, xSDL::Surface *surf);
   Image(Screen *Screen, xSDL::Surface&& surf);
+
+  /**
+   * `region` of `surf`, in a texture of its own.
+   */
   Image(Screen *Screen, xSDL::Surface *surf, const xSDL::Rect &region);
   Image(Screen *Screen, xSDL::Surface&& surf, const xSDL::Rect &region);
 
+  /**
+   * A view of `region` of `atlas`: no pixels are copied, and the texture is
+   * shared, so draws of views of the same atlas can be batched together
+   * (see SpriteBatch and Screen::begin_queued). The texture lives as long as
+   * any image using it. The view starts with the atlas' state.
+   *
+   * @note Neighbouring regions may bleed into the view's edges when it's
+   * drawn scaled or rotated, unless they're a pixel apart.
+   */
+  Image(const Image *atlas, const xSDL::Rect &region);
+
+  /**
+   * A blank image, meant to be drawn into with a RenderTargetGuard.
+   */
+  Image(Screen *Screen, int width, int height);
+
   Image(Image&& src) noexcept;
   Image& operator=(Image&& src) noexcept;
 
@@ -127,9 +162,38 @@ public:
   int
   height() const noexcept;
 
+  /**
+   * Whether this image and `other` are drawn from the same texture, e.g.
+   * because they're views of the same atlas.
+   */
+  bool
+  shares_texture_with(const Image *other) const noexcept;
+
 private:
-  xSDL::Texture tex;
+  /**
+   * Gives the texture the image's state, to draw it.
+   */
+  void
+  bind() const;
+
+  std::shared_ptr<xSDL::Texture> tex;
+
+  // Where the image is in the texture, in pixels and in texture
+  // coordinates, and the texture's size.
+  xSDL::Rect region;
+  xMATH::Float2 uv_min, uv_max;
+  int tex_w, tex_h;
+
   int w, h;
+
+  uint8_t alpha_mod;
+  xSDL::Color color_mod;
+  xSDL::BlendMode blend_mode;
+
+  // Tells textures apart in the screen's draw queue. Ids are handed out in
+  // creation order and only the low bits get used, so they may repeat, which
+  // only means that images may not get grouped. Views get their atlas' id.
+  uint32_t id;
 };
 
 class BlendModeGuard {
@@ -200,6 +264,7 @@ private:
 
 class Screen {
   friend class Image;
+  friend class RenderTargetGuard;
 
 public:
   Screen(xSDL::Renderer *rend, int width, int height) noexcept;
@@ -213,9 +278,90 @@ public:
   Image
   load_image(const char *file_name);
 
+  /**
+   * Loads the files in parallel, on `pool`'s threads. Textures are created
+   * on this thread, each as soon as its file is loaded, while the following
+   * ones still are.
+   */
+  std::vector<Image>
+  load_images(WORK::Pool *pool, const char * const *file_names,
+              int num_files);
+
+  /**
+   * Switches the screen to queued mode: until end_queued is called, draws
+   * are recorded instead of going to the renderer. The image's alpha mod,
+   * color mod and blend mode are recorded along with each draw, so they can
+   * be changed right after it as usual.
+   *
+   * end_queued sorts the draws by layer (see set_layer), then blend mode,
+   * then texture (views of an atlas share one), and draws them in that
+   * order, changing textures' state only when it has to. Draws with the same
+   * layer, blend mode and texture keep the order they were made in. Within a
+   * layer, though, draws of different textures are reordered, so anything
+   * that has to be drawn over something else needs a higher layer.
+   */
+  void
+  begin_queued() noexcept;
+
+  /**
+   * Draws everything recorded since begin_queued and goes back to drawing
+   * immediately. Images are left with the state they had before the
+   * queued draws got drawn.
+   */
+  void
+  end_queued();
+
+  /**
+   * Layer of the draws queued from now on. Higher layers are drawn over lower
+   * ones. It's 0 at first and after end_queued.
+   */
+  void
+  set_layer(uint8_t layer) noexcept;
+
   void
   fill_square(xMATH::Float2 center, float side, xSDL::Color color);
 
+  void
+  draw_line(xMATH::Float2 from, xMATH::Float2 to, xSDL::Color color);
+
+  /**
+   * Draws the static layer called `name`: something that looks the same
+   * frame after frame, like a background grid or a level's walls. The first
+   * time, draw(this) is called to draw it, into an image the size of the
+   * screen. After that, the image is drawn with a single copy, until the
+   * layer is dirtied or the screen resized.
+   *
+   * If the renderer can't draw into images, draw is called every time.
+   *
+   * @note draw must only draw on this screen. Images drawn by it are drawn
+   * with the state they have then, and later changes to it don't show until
+   * the layer is drawn again.
+   */
+  template<typename Fn>
+  void
+  draw_static_layer(const char *name, Fn&& draw) {
+    typedef typename std::remove_reference<Fn>::type F;
+    static_layer(name, [](void *ctx, Screen *screen) {
+      (*static_cast<F*>(ctx))(screen);
+    }, &draw);
+  }
+
+  /**
+   * Makes the static layer called `name` be drawn again the next time.
+   */
+  void
+  dirty_static_layer(const char *name) noexcept;
+
+  void
+  dirty_static_layers() noexcept;
+
+  /**
+   * Changes the size of the screen, as when the window is resized. Every
+   * static layer is dirtied.
+   */
+  void
+  resize(int width, int height) noexcept;
+
   /**
    * Draw the image with its CENTER at x,y and rotated by ANGLE around its
    * center. You should also specify x,y from left->right and bottom->up.
@@ -292,17 +438,493 @@ public:
                  float angle, xMATH::Float2 rot_center,
                  SDL_RendererFlip flip = SDL_FLIP_NONE);
 
+  /**
+   * These draw as their float angle counterparts do, with the transform in
+   * place of the rotation: `center` is given in the transform's frame, and
+   * the image is drawn at transform.apply(center), rotated by its angle. For
+   * instance, with transform = Transform2D(angle, rot_center),
+   * draw_image_270(img, offset, transform) is
+   * draw_image_270(img, rot_center + offset, angle, rot_center).
+   *
+   * None of them compute any sine or cosine, so a transform can be made once
+   * and reused to draw every piece of something.
+   */
+  void
+  draw_image(Image *img, xMATH::Float2 center,
+             const xMATH::Transform2D &transform,
+             SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  void
+  draw_image_90(Image *img, xMATH::Float2 center,
+                const xMATH::Transform2D &transform,
+                SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  void
+  draw_image_180(Image *img, xMATH::Float2 center,
+                 const xMATH::Transform2D &transform,
+                 SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  void
+  draw_image_270(Image *img, xMATH::Float2 center,
+                 const xMATH::Transform2D &transform,
+                 SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  /**
+   * Draws the `region` of `img` (in pixels, from its top left corner) with
+   * its center at `center`, unrotated.
+   */
+  void
+  draw_image_region(Image *img, const xSDL::Rect &region,
+                    xMATH::Float2 center,
+                    SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  /**
+   * Writes into `quad` the 4 vertices of `img` drawn with its center at
+   * `center` and rotated around it by the angle whose cosine and sine are
+   * `cos_sin`. This places the image exactly where draw_image would, but it
+   * doesn't draw anything: the quads are meant to be accumulated and then
+   * drawn all at once with draw_quads.
+   *
+   * `color` goes into the vertices and modulates the texture the same way
+   * color and alpha mods do.
+   */
+  void
+  image_quad(const Image *img, xMATH::Float2 center, xMATH::Float2 cos_sin,
+             xSDL::Color color, xSDL::Vertex quad[4]) const noexcept;
+
+  /**
+   * Draws `num_quads` quads (4 vertices each, as written by image_quad)
+   * textured by `img` with a single call to the renderer. The quads can be
+   * of any images sharing img's texture.
+   *
+   * @note The image's blend mode is used. Its color and alpha mods are
+   * left to the renderer, so you probably want them at their neutral values
+   * and the modulation in the vertices' color.
+   */
+  void
+  draw_quads(Image *img, const xSDL::Vertex *vertices, int num_quads);
+
   int
   width() const noexcept;
 
   int
   height() const noexcept;
 
+  /**
+   * Whether images can be drawn into (see RenderTargetGuard).
+   */
+  bool
+  supports_render_targets() const noexcept;
+
+  /**
+   * Whether images can be drawn with `mode` (see
+   * xSDL::Renderer::supports_blend_mode).
+   */
+  bool
+  supports_blend_mode(xSDL::BlendMode mode);
+
 private:
+  /**
+   * A recorded draw. Everything needed to issue it later, including the state
+   * of its image at the time it was recorded.
+   */
+  struct DrawCommand {
+    enum Kind : uint8_t {
+      COPY,
+      QUADS,
+      FILL,
+      LINE
+    };
+
+    Kind kind;
+    uint8_t alpha_mod;
+    xSDL::RenderFlip flip;
+    xSDL::BlendMode blend_mode;
+
+    // Color mod for COPY and QUADS, draw color for FILL and LINE.
+    SDL_Color color;
+
+    // Null for FILL and LINE.
+    Image *img;
+
+    // COPY and FILL. src is in the texture's pixels (FILL has none).
+    struct CopyArgs {
+      SDL_Rect rect;
+      SDL_Rect src;
+      float angle_degrees;
+    };
+
+    // QUADS: they're in the queue's vertices.
+    struct QuadsArgs {
+      int first_vertex;
+      int num_quads;
+    };
+
+    // LINE.
+    struct LineArgs {
+      int x1, y1, x2, y2;
+    };
+
+    union {
+      CopyArgs copy;
+      QuadsArgs quads;
+      LineArgs line;
+    };
+  };
+
+  // Everything used by queued mode.
+  struct DrawQueue {
+    bool active;
+    uint8_t layer;
+
+    std::vector<DrawCommand> commands;
+
+    // Sort key of each command: layer, blend mode, image id and the command's
+    // index, from the most to the least significant bits. Being unique, the
+    // index keeps the sort stable and also tells which command a key is for.
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> sort_scratch;
+
+    std::vector<xSDL::Vertex> vertices;
+
+    // Images of static layers drawn again while commands drawing their old
+    // image were queued. They're freed once the queue is drained.
+    std::vector<std::unique_ptr<Image>> retired_layers;
+  };
+
+  /**
+   * Records a command and its sort key.
+   */
+  void
+  enqueue(const DrawCommand &cmd);
+
+  typedef void (*LayerFn)(void *ctx, Screen *screen);
+
+  struct StaticLayer {
+    std::string name;
+
+    // Null until drawn, and when dirty. A layer dirtied while queued
+    // commands draw its image keeps it until they're drawn, and is marked
+    // dirty meanwhile.
+    std::unique_ptr<Image> img;
+    bool dirty;
+  };
+
+  void
+  static_layer(const char *name, LayerFn draw, void *ctx);
+
+  void
+  dirty(StaticLayer *layer) noexcept;
+
+  /**
+   * Frees the images of the layers dirtied while commands were queued, now
+   * that the queue is empty.
+   */
+  void
+  release_dirty_layers() noexcept;
+
+  /**
+   * Index buffer for drawing `num_quads` quads.
+   */
+  const int*
+  indices_for_quads(int num_quads);
+
+  /**
+   * Copies the `src` region of `img` (all of it if null) into `dest`, or
+   * records the copy when in queued mode.
+   */
+  void
+  copy_image(Image *img, const xSDL::Rect *src, const xSDL::Rect &dest,
+             double angle_degrees, xSDL::RenderFlip flip);
+
   xSDL::Renderer *rend;
   int w, h;
+
+  // Shared by every draw_quads call: 0 1 2, 0 2 3, 4 5 6, 4 6 7, ...
+  std::vector<int> quad_indices;
+
+  DrawQueue queue;
+
+  // A handful at most, so they're searched by name.
+  std::vector<StaticLayer> static_layers;
+};
+
+/**
+ * For as long as it lives, what's drawn on `screen` goes into `target`
+ * instead, and the screen's size is the image's, so coordinates are relative
+ * to the image. Unless `clear` is false, the image is cleared to transparent
+ * first. When it's destroyed, drawing goes back to the renderer's default
+ * target.
+ *
+ * If the screen is in queued mode, it's suspended: draws into the target are
+ * made right away, and the ones already queued still go to the default
+ * target.
+ *
+ * @note Guards can't be nested.
+ */
+class RenderTargetGuard {
+public:
+  RenderTargetGuard(Screen *screen, Image *target, bool clear = true);
+
+  RenderTargetGuard& operator=(const RenderTargetGuard&) = delete;
+  RenderTargetGuard(const RenderTargetGuard&) = delete;
+
+  ~RenderTargetGuard();
+
+private:
+  Screen *screen;
+  int restore_w, restore_h;
+  bool restore_queued;
 };
 
+/**
+ * Counters kept by a PreRotatedImage since its creation.
+ */
+struct PreRotationStats {
+  // Draws that were plain copies of a pre-rotated angle, and draws too far
+  // from any of them, which were drawn rotated.
+  uint64_t hits;
+  uint64_t misses;
+
+  int angles_rendered;
+
+  // Texture memory held by the atlas.
+  size_t bytes_reserved;
+};
+
+/**
+ * An image pre-rendered at `num_angles` angles evenly spread around the
+ * circle, all in one atlas. Draws at an angle within `tolerance` of one of
+ * them are plain copies of it, which renderers (the software one above all)
+ * do much faster than rotated copies. Other draws are rotated copies of the
+ * image, as Screen::draw_image does.
+ *
+ * More angles give better looking draws, at the cost of more memory: the
+ * atlas is `num_angles` squares as wide as the image's diagonal. A tolerance
+ * of half the angle between them makes every draw a hit, and the image
+ * snaps to the nearest angle. A smaller one keeps the exact angle when it
+ * matters more.
+ *
+ * Draws use the image's alpha mod, color mod and blend mode, as
+ * Screen::draw_image does.
+ */
+class PreRotatedImage {
+public:
+  enum {
+    DEFAULT_NUM_ANGLES = 64
+  };
+
+  enum Rendering {
+    // Each angle is rendered the first time it's drawn.
+    LAZILY,
+
+    // Every angle is rendered by the constructor.
+    AT_ONCE
+  };
+
+  /**
+   * Throws std::invalid_argument if num_angles isn't positive. A negative
+   * tolerance is half the angle between pre-rendered angles.
+   *
+   * @note It needs a renderer which can draw into images. Without one,
+   * every draw is a miss.
+   */
+  PreRotatedImage(Screen *screen, Image *img,
+                  int num_angles = DEFAULT_NUM_ANGLES,
+                  float tolerance = -1.0f,
+                  Rendering rendering = LAZILY);
+
+  /**
+   * Draws as screen->draw_image(img, center, angle, flip) does, give or take
+   * the tolerance.
+   */
+  void
+  draw(xMATH::Float2 center, float angle,
+       SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  /**
+   * Forgets the rendered angles, so they're rendered again when next drawn.
+   * Call it when the renderer's targets are reset (see
+   * SDL_RENDER_TARGETS_RESET).
+   */
+  void
+  invalidate() noexcept;
+
+  const PreRotationStats&
+  stats() const noexcept;
+
+private:
+  /**
+   * Renders angle `k` into its cell of the atlas.
+   */
+  void
+  render_angle(int k);
+
+  xSDL::Rect
+  cell(int k) const noexcept;
+
+  Screen *screen;
+  Image *img;
+  int num_angles;
+  float step;
+  float tolerance;
+
+  // Cells are squares `side` pixels wide, `columns` to a row.
+  int side;
+  int columns;
+
+  // Null if the renderer can't draw into images.
+  std::unique_ptr<Image> atlas;
+  std::vector<bool> rendered;
+
+  PreRotationStats counters;
+};
+
+/**
+ * An image to be drawn by a SpriteBatch, placed as Screen::draw_image would:
+ * `center` is rotated by `angle` around `rot_center`, and the image is drawn
+ * there, rotated by `angle` around its own center. For a plain rotation
+ * around the image's center, rot_center is center.
+ *
+ * `color` modulates the image, its alpha included, the same way color and
+ * alpha mods do.
+ */
+struct Sprite {
+  enum Flags : uint8_t {
+    // These follow the conventions of Screen::draw_image_90, _180 and _270:
+    // an image pointing down, left or up is drawn turned to point right at
+    // angle 0. Only one of them can be given.
+    ROTATE_90 = 1,
+    ROTATE_180 = 2,
+    ROTATE_270 = 3,
+
+    // As SDL_FLIP_HORIZONTAL and SDL_FLIP_VERTICAL.
+    FLIP_HORIZONTAL = 1 << 2,
+    FLIP_VERTICAL = 1 << 3
+  };
+
+  Image *img;
+  xMATH::Float2 center;
+  float angle;
+  xMATH::Float2 rot_center;
+  xSDL::Color color;
+  uint8_t flags;
+};
+
+/**
+ * Collects sprites and draws them with as few calls to the renderer as
+ * possible: each run of sprites sharing a texture and a blend mode becomes a
+ * single batch of geometry. Views of the same atlas share their texture.
+ */
+class SpriteBatch {
+public:
+  enum Order {
+    // Sprites are drawn in the order they were added, so later ones are
+    // drawn over earlier ones. Only consecutive sprites of the same texture
+    // get batched together.
+    IN_ORDER,
+
+    // Sprites are grouped by texture and blend mode (keeping the order among
+    // sprites of a group), so each group is drawn with a single call. Use it
+    // when sprites of different groups don't overlap, or when it doesn't
+    // matter which one is on top.
+    BY_IMAGE
+  };
+
+  explicit SpriteBatch(Screen *screen) noexcept;
+
+  void
+  add(const Sprite &sprite);
+
+  void
+  add(const Sprite *sprites, size_t num_sprites);
+
+  /**
+   * Adds sprites given in the frame of `transform`: their center, angle and
+   * rot_center are transformed by it. Sprites at angle 0 take no sine or
+   * cosine at all, so the pieces of something can share the one transform.
+   */
+  void
+  add(const Sprite &sprite, const xMATH::Transform2D &transform);
+
+  void
+  add(const Sprite *sprites, size_t num_sprites,
+      const xMATH::Transform2D &transform);
+
+  /**
+   * Draws the sprites added since the last draw, and forgets them.
+   *
+   * @note Each image's blend mode is used. Its color and alpha mods are set
+   * to their neutral values while drawing, and restored afterwards.
+   */
+  void
+  draw(Order order = IN_ORDER);
+
+  /**
+   * Forgets the sprites added since the last draw without drawing them.
+   */
+  void
+  clear() noexcept;
+
+private:
+  /**
+   * A sprite once its rotations are resolved: its image goes at `center`,
+   * rotated by the angle whose cosine and sine are `cos_sin`. Only the flip
+   * flags are left.
+   */
+  struct Placed {
+    Image *img;
+    xMATH::Float2 center;
+    xMATH::Float2 cos_sin;
+    xSDL::Color color;
+    uint8_t flags;
+  };
+
+  static Placed
+  place(const Sprite &sprite) noexcept;
+
+  void
+  sprite_quad(const Placed &sprite, xSDL::Vertex quad[4]) const noexcept;
+
+  Screen *screen;
+  std::vector<Placed> sprites;
+
+  // Reused by every draw.
+  std::vector<uint32_t> order;
+  std::vector<xSDL::Vertex> vertices;
+};
+
+// This is inline because it's called once per particle.
+inline void
+Screen::
+image_quad(const Image *img, xMATH::Float2 center, xMATH::Float2 cos_sin,
+           xSDL::Color color, xSDL::Vertex quad[4]) const noexcept
+{
+  const float half_w = img->w*0.5f;
+  const float half_h = img->h*0.5f;
+
+  // Corners relative to the center (y up), rotated. The bottom corners are
+  // the negation of the top ones.
+  const xMATH::Float2 top_left =
+    xMATH::rotate(xMATH::Float2(-half_w, half_h), cos_sin);
+  const xMATH::Float2 top_right =
+    xMATH::rotate(xMATH::Float2(half_w, half_h), cos_sin);
+
+  // Screen coordinates have y growing down.
+  const float x = center.x();
+  const float y = h - 1.0f - center.y();
+
+  const float u0 = img->uv_min.x();
+  const float v0 = img->uv_min.y();
+  const float u1 = img->uv_max.x();
+  const float v1 = img->uv_max.y();
+
+  quad[0] = {{x + top_left.x(), y - top_left.y()}, color, {u0, v0}};
+  quad[1] = {{x + top_right.x(), y - top_right.y()}, color, {u1, v0}};
+  quad[2] = {{x - top_left.x(), y + top_left.y()}, color, {u1, v1}};
+  quad[3] = {{x - top_right.x(), y + top_right.y()}, color, {u0, v1}};
+}
+
 } // end of gral
 
 #endif
@@ -0,0 +1,234 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "InputRecording.hpp"
+
+namespace INPUT {
+
+namespace {
+
+const char MAGIC[4] = {'F', 'C', 'I', 'R'};
+
+enum : uint8_t {
+  VERSION = 1
+};
+
+enum RecordType : uint8_t {
+  CLOCK = 1,
+  KEY_DOWN,
+  KEY_UP,
+  MOUSE_MOTION,
+  MOUSE_BUTTON_DOWN,
+  MOUSE_BUTTON_UP,
+  QUIT
+};
+
+} // end of anonymous
+
+bool
+is_recorded(Uint32 type) noexcept {
+  switch (type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_QUIT:
+      return true;
+  }
+  return false;
+}
+
+////
+// Recorder
+
+Recorder::
+Recorder(const char *file_name, uint64_t seed)
+  : out {file_name, std::ios::binary},
+    last_clock_ms {0}
+{
+  out.write(MAGIC, sizeof(MAGIC));
+  out.put(char(VERSION));
+  for (int i = 0; i < 8; i++) {
+    out.put(char(seed >> 8*i));
+  }
+  if (!out) {
+    throw RecordingError(std::string("Couldn't write ") + file_name);
+  }
+}
+
+void
+Recorder::
+put_uint(uint32_t v) {
+  while (v >= 0x80) {
+    out.put(char(v | 0x80));
+    v >>= 7;
+  }
+  out.put(char(v));
+}
+
+void
+Recorder::
+put_int(int32_t v) {
+  put_uint((uint32_t(v) << 1) ^ uint32_t(v >> 31));
+}
+
+void
+Recorder::
+clock(uint32_t ms) {
+  out.put(char(CLOCK));
+  put_uint(ms - last_clock_ms);
+  last_clock_ms = ms;
+}
+
+void
+Recorder::
+event(const SDL_Event &e) {
+  switch (e.type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      out.put(char(e.type == SDL_KEYDOWN ? KEY_DOWN : KEY_UP));
+      put_uint(uint32_t(e.key.keysym.sym));
+      put_uint(e.key.repeat);
+      break;
+    case SDL_MOUSEMOTION:
+      out.put(char(MOUSE_MOTION));
+      put_int(e.motion.x);
+      put_int(e.motion.y);
+      break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      out.put(char(e.type == SDL_MOUSEBUTTONDOWN ? MOUSE_BUTTON_DOWN
+                                                 : MOUSE_BUTTON_UP));
+      put_uint(e.button.button);
+      put_int(e.button.x);
+      put_int(e.button.y);
+      break;
+    case SDL_QUIT:
+      out.put(char(QUIT));
+      break;
+  }
+}
+
+////
+// Replayer
+
+Replayer::
+Replayer(const char *file_name)
+  : data {},
+    pos {0},
+    recorded_seed {0},
+    clock_ms {0}
+{
+  std::ifstream in {file_name, std::ios::binary};
+  if (!in) {
+    throw RecordingError(std::string("Couldn't read ") + file_name);
+  }
+  data.assign(std::istreambuf_iterator<char>(in),
+              std::istreambuf_iterator<char>());
+
+  const size_t header_size = sizeof(MAGIC) + 1 + 8;
+  if (data.size() < header_size ||
+      std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0 ||
+      data[sizeof(MAGIC)] != VERSION)
+  {
+    throw RecordingError(std::string(file_name) +
+                         " isn't an input recording");
+  }
+  for (int i = 0; i < 8; i++) {
+    recorded_seed |= uint64_t(data[sizeof(MAGIC) + 1 + i]) << 8*i;
+  }
+  pos = header_size;
+}
+
+uint64_t
+Replayer::
+seed() const noexcept {
+  return recorded_seed;
+}
+
+uint32_t
+Replayer::
+get_uint() {
+  uint32_t v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (pos == data.size()) {
+      break;
+    }
+    const uint8_t byte = data[pos++];
+    v |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return v;
+    }
+  }
+  throw RecordingError("Input recording corrupt");
+}
+
+int32_t
+Replayer::
+get_int() {
+  const uint32_t v = get_uint();
+  return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+bool
+Replayer::
+clock(uint32_t *ms) {
+  SDL_Event skipped;
+  while (poll_event(&skipped)) {
+  }
+  if (pos == data.size()) {
+    return false;
+  }
+  pos++;
+  clock_ms += get_uint();
+  *ms = clock_ms;
+  return true;
+}
+
+bool
+Replayer::
+poll_event(SDL_Event *e) {
+  if (pos == data.size() || data[pos] == CLOCK) {
+    return false;
+  }
+
+  SDL_zerop(e);
+  e->common.timestamp = clock_ms;
+  switch (data[pos++]) {
+    case KEY_DOWN:
+    case KEY_UP:
+      e->type = data[pos - 1] == KEY_DOWN ? SDL_KEYDOWN : SDL_KEYUP;
+      e->key.state = e->type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+      e->key.keysym.sym = SDL_Keycode(get_uint());
+      e->key.repeat = get_uint();
+      break;
+    case MOUSE_MOTION:
+      e->type = SDL_MOUSEMOTION;
+      e->motion.x = get_int();
+      e->motion.y = get_int();
+      break;
+    case MOUSE_BUTTON_DOWN:
+    case MOUSE_BUTTON_UP:
+      e->type = data[pos - 1] == MOUSE_BUTTON_DOWN ? SDL_MOUSEBUTTONDOWN
+                                                   : SDL_MOUSEBUTTONUP;
+      e->button.state = e->type == SDL_MOUSEBUTTONDOWN ? SDL_PRESSED
+                                                       : SDL_RELEASED;
+      e->button.button = get_uint();
+      e->button.x = get_int();
+      e->button.y = get_int();
+      break;
+    case QUIT:
+      e->type = SDL_QUIT;
+      break;
+    default:
+      throw RecordingError("Input recording corrupt");
+  }
+  return true;
+}
+
+} // end of input
@@ -0,0 +1,112 @@
+#ifndef INPUT_RECORDING_HPP
+#define INPUT_RECORDING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+/**
+ * Recordings of a run's input, to replay it exactly.
+ *
+ * A recording holds the seed of the run's random numbers, then a record per
+ * clock reading and per input event, in the order the run made or got them.
+ * Replayed, the clock readings stand in for the real clock, so the run goes
+ * through the same ticks with the same events, whatever the frame rate.
+ *
+ * File format: the magic "FCIR", a version byte, the seed (8 bytes, little
+ * endian), then records. A record is a type byte followed by its fields, as
+ * LEB128 varints (signed ones zigzag encoded). Clock readings are stored as
+ * the ms since the previous one.
+ */
+
+namespace INPUT {
+
+class RecordingError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * Whether events of type `type` are input, and so go into recordings.
+ */
+bool
+is_recorded(Uint32 type) noexcept;
+
+class Recorder {
+public:
+  /**
+   * Throws RecordingError if `file_name` can't be written.
+   */
+  Recorder(const char *file_name, uint64_t seed);
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  void
+  clock(uint32_t ms);
+
+  /**
+   * Events that aren't input are left out.
+   */
+  void
+  event(const SDL_Event &e);
+
+private:
+  void
+  put_uint(uint32_t v);
+
+  void
+  put_int(int32_t v);
+
+  std::ofstream out;
+  uint32_t last_clock_ms;
+};
+
+class Replayer {
+public:
+  /**
+   * Reads the whole recording. Throws RecordingError if it can't be read,
+   * or isn't a recording.
+   */
+  explicit Replayer(const char *file_name);
+
+  Replayer(const Replayer&) = delete;
+  Replayer& operator=(const Replayer&) = delete;
+
+  uint64_t
+  seed() const noexcept;
+
+  /**
+   * Next clock reading. Events of the previous one that weren't polled are
+   * skipped. Returns false at the end of the recording.
+   */
+  bool
+  clock(uint32_t *ms);
+
+  /**
+   * Next event recorded since the last clock reading, if any. Throws
+   * RecordingError if the recording is corrupt.
+   */
+  bool
+  poll_event(SDL_Event *e);
+
+private:
+  uint32_t
+  get_uint();
+
+  int32_t
+  get_int();
+
+  std::vector<uint8_t> data;
+  size_t pos;
+  uint64_t recorded_seed;
+  uint32_t clock_ms;
+};
+
+} // end of input
+
+#endif
@@ -3,86 +3,837 @@
 #include <cstdint>
 #include <cmath>
 #include <cstdlib>
+#include <algorithm>
+#include <climits>
+#include <new>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #include "xMath.hpp"
+#include "xRandom.hpp"
 #include "xSDL.hpp"
 #include "Graphical.hpp"
 #include "ParticlesSystem.hpp"
+#include "Trace.hpp"
+
+#if !defined(PARTICLES_COMPACT)
+/**
+ * Computes out = start + dt*vel for n particles. The arrays have to be 16
+ * bytes aligned and n has to be a multiple of 4.
+ */
+static void
+eval_positions(const float *vx, const float *vy, int n,
+               float dt, xMATH::Float2 start,
+               float *out_x, float *out_y) noexcept
+{
+#if defined(__SSE__)
+  const __m128 dt4 = _mm_set1_ps(dt);
+  const __m128 start_x4 = _mm_set1_ps(start.x());
+  const __m128 start_y4 = _mm_set1_ps(start.y());
+
+  for (int i = 0; i < n; i += 4) {
+    __m128 x = _mm_mul_ps(dt4, _mm_load_ps(vx + i));
+    __m128 y = _mm_mul_ps(dt4, _mm_load_ps(vy + i));
+    _mm_store_ps(out_x + i, _mm_add_ps(start_x4, x));
+    _mm_store_ps(out_y + i, _mm_add_ps(start_y4, y));
+  }
+#else
+  for (int i = 0; i < n; i++) {
+    out_x[i] = start.x() + dt*vx[i];
+    out_y[i] = start.y() + dt*vy[i];
+  }
+#endif
+}
+#else
+/**
+ * Same, for quantized velocities: out = start + dt*vel_unit*vel.
+ */
+static void
+eval_positions(const int16_t *vx, const int16_t *vy, int n,
+               float dt, float vel_unit, xMATH::Float2 start,
+               float *out_x, float *out_y) noexcept
+{
+#if defined(__SSE2__)
+  const __m128 scale4 = _mm_set1_ps(dt*vel_unit);
+  const __m128 start_x4 = _mm_set1_ps(start.x());
+  const __m128 start_y4 = _mm_set1_ps(start.y());
 
-inline float
-RAND_01_f() {
-  return float(rand())/float(RAND_MAX);
+  for (int i = 0; i < n; i += 4) {
+    // Widen to 32 bits by putting each value in the high half of its lane,
+    // then shifting it down with sign extension.
+    __m128i x16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(vx + i));
+    __m128i y16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(vy + i));
+    __m128i x32 = _mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 16);
+    __m128i y32 = _mm_srai_epi32(_mm_unpacklo_epi16(y16, y16), 16);
+    __m128 x = _mm_mul_ps(scale4, _mm_cvtepi32_ps(x32));
+    __m128 y = _mm_mul_ps(scale4, _mm_cvtepi32_ps(y32));
+    _mm_store_ps(out_x + i, _mm_add_ps(start_x4, x));
+    _mm_store_ps(out_y + i, _mm_add_ps(start_y4, y));
+  }
+#else
+  const float scale = dt*vel_unit;
+  for (int i = 0; i < n; i++) {
+    out_x[i] = start.x() + scale*vx[i];
+    out_y[i] = start.y() + scale*vy[i];
+  }
+#endif
 }
+#endif
 
 namespace GAME {
 
+#if defined(PARTICLES_COMPACT)
+/**
+ * Memory reserved per particle in an arena: 3 16 bits arrays, the 2 float
+ * arrays of positions, plus its quad.
+ */
+static constexpr size_t PARTICLE_BYTES = 3*sizeof (int16_t) +
+                                         2*sizeof (float) +
+                                         4*sizeof (xSDL::Vertex);
+
+// Quantized velocities go from -VEL_UNITS to VEL_UNITS.
+static constexpr float VEL_UNITS = 32767.0f;
+
+/**
+ * Cosines of binary angles, by their top COS_TABLE_BITS bits. Sines are
+ * cosines a quarter turn back.
+ */
+enum {
+  COS_TABLE_BITS = 10
+};
+
+struct CosTable {
+  CosTable() noexcept {
+    for (int i = 0; i < 1 << COS_TABLE_BITS; i++) {
+      cos[i] = std::cos(i*2.0f*xMATH::PI<float>()/(1 << COS_TABLE_BITS));
+    }
+  }
+
+  xMATH::Float2
+  cos_sin(uint16_t angle) const noexcept {
+    constexpr int SHIFT = 16 - COS_TABLE_BITS;
+    return xMATH::Float2 {cos[angle >> SHIFT],
+                          cos[uint16_t(angle - 0x4000) >> SHIFT]};
+  }
+
+  float cos[1 << COS_TABLE_BITS];
+};
+
+static const CosTable cos_table;
+#else
+/**
+ * Memory reserved per particle in an arena: 6 float arrays plus its quad.
+ */
+static constexpr size_t PARTICLE_BYTES = 6*sizeof (float) +
+                                         4*sizeof (xSDL::Vertex);
+#endif
+
+/**
+ * The values in a vector of lanes, as a plain array.
+ */
+template<typename Lanes>
+static inline auto
+elements(std::vector<Lanes>& lanes) noexcept -> decltype(lanes.data()->v+0) {
+  return reinterpret_cast<decltype(lanes.data()->v+0)>(lanes.data());
+}
+
 ParticlesSystem::
-ParticlesSystem() noexcept
-  : batches_used {0}
-{}
+ParticlesSystem(uint64_t seed, size_t memory_budget, WORK::Pool *pool)
+  : pool {pool},
+    rng {seed},
+    batches_updated {0},
+    counters {}
+{
+  counters.bytes_budget = memory_budget;
+}
+
+void
+ParticlesSystem::
+reseed(uint64_t seed) noexcept {
+  rng.reseed(seed);
+}
+
+void
+ParticlesSystem::FreeBatchesChunk::
+operator()(ParticlesBatch *chunk) const noexcept {
+  static_assert(std::is_trivially_destructible<ParticlesBatch>::value,
+                "Chunks are freed without destroying their batches");
+  std::free(chunk);
+}
+
+bool
+ParticlesSystem::
+grow_batches() noexcept {
+  // Besides the batches, each one also needs a slot in free_batches and one
+  // in live_batches.
+  constexpr size_t CHUNK_BYTES =
+    BATCHES_PER_CHUNK*(sizeof (ParticlesBatch) + 2*sizeof (ParticlesBatch*));
+
+  if (counters.bytes_reserved + CHUNK_BYTES > counters.bytes_budget) {
+    return false;
+  }
+
+  try {
+    const size_t capacity = counters.batches_capacity + BATCHES_PER_CHUNK;
+
+    // Reserve everything first, so nothing below can throw.
+    chunks.reserve(chunks.size() + 1);
+    free_batches.reserve(capacity);
+    live_batches.reserve(capacity);
+
+    void *memory;
+    if (posix_memalign(&memory, alignof (ParticlesBatch),
+                       BATCHES_PER_CHUNK*sizeof (ParticlesBatch)) != 0)
+    {
+      return false;
+    }
+    ParticlesBatch *chunk = static_cast<ParticlesBatch*>(memory);
+    for (int i = 0; i < BATCHES_PER_CHUNK; i++) {
+      new (chunk + i) ParticlesBatch;
+    }
+    chunks.emplace_back(chunk);
+    for (int i = BATCHES_PER_CHUNK-1; i >= 0; i--) {
+      free_batches.push_back(chunk + i);
+    }
+  }
+  catch (std::bad_alloc&) {
+    return false;
+  }
+
+  counters.batches_capacity += BATCHES_PER_CHUNK;
+  counters.bytes_reserved += CHUNK_BYTES;
+  return true;
+}
+
+/**
+ * Memory taken by a duration class besides its arena and its ring of batches.
+ */
+template<typename Class>
+static constexpr size_t
+class_bytes() noexcept {
+  return sizeof (Class) + sizeof (std::unique_ptr<Class>);
+}
+
+/**
+ * Whether a batch started at `ms_start` and lasting `ms_duration` is over at
+ * `ms_now`. Batches starting after ms_now count as over too.
+ */
+static inline bool
+expired(uint32_t ms_start, uint32_t ms_duration, uint32_t ms_now) noexcept {
+  return ms_now - ms_start > ms_duration;
+}
+
+/**
+ * Whether a batch started at `ms_start` is yet to start at `ms_now`.
+ */
+static inline bool
+pending(uint32_t ms_start, uint32_t ms_now) noexcept {
+  return int32_t(ms_start - ms_now) > 0;
+}
+
+static inline int
+padded_count(int count, int simd_width) noexcept {
+  return (count + simd_width - 1)/simd_width*simd_width;
+}
+
+ParticlesSystem::DurationClass*
+ParticlesSystem::
+class_for(uint32_t ms_duration) noexcept {
+  DurationClass *empty = nullptr;
+  for (auto& cls : classes) {
+    if (cls->ms_duration == ms_duration) {
+      return cls.get();
+    }
+    if (!empty && cls->num_batches == 0) {
+      empty = cls.get();
+    }
+  }
+
+  if (empty) {
+    empty->ms_duration = ms_duration;
+    return empty;
+  }
+
+  constexpr size_t CLASS_BYTES = class_bytes<DurationClass>();
+  if (counters.bytes_reserved + CLASS_BYTES > counters.bytes_budget) {
+    return nullptr;
+  }
+
+  try {
+    classes.emplace_back(new DurationClass());
+  }
+  catch (std::bad_alloc&) {
+    return nullptr;
+  }
+
+  DurationClass *cls = classes.back().get();
+  cls->ms_duration = ms_duration;
+  counters.bytes_reserved += CLASS_BYTES;
+  return cls;
+}
+
+bool
+ParticlesSystem::
+release_idle_classes(const DurationClass *keep) noexcept {
+  size_t freed = 0;
+  size_t num_kept = 0;
+  for (size_t i = 0; i < classes.size(); i++) {
+    DurationClass *cls = classes[i].get();
+    if (cls == keep || cls->num_batches > 0) {
+      if (num_kept != i) {
+        classes[num_kept] = std::move(classes[i]);
+      }
+      num_kept++;
+      continue;
+    }
+
+    freed += class_bytes<DurationClass>() +
+             cls->batches.size()*sizeof (ParticlesBatch*) +
+             cls->arena.capacity*PARTICLE_BYTES;
+    counters.particles_capacity -= cls->arena.capacity;
+    classes[i].reset();
+  }
+  classes.resize(num_kept);
+
+  counters.bytes_reserved -= freed;
+  vertices.resize(counters.particles_capacity*4);
+  return freed > 0;
+}
+
+bool
+ParticlesSystem::
+grow_class_ring(DurationClass *cls) noexcept {
+  const size_t size = cls->batches.size();
+  const size_t new_size = size ? size*2 : size_t(MIN_CLASS_RING);
+  const size_t bytes = (new_size - size)*sizeof (ParticlesBatch*);
+
+  if (counters.bytes_reserved + bytes > counters.bytes_budget) {
+    return false;
+  }
+
+  try {
+    std::vector<ParticlesBatch*> ring(new_size);
+    for (size_t i = 0; i < cls->num_batches; i++) {
+      ring[i] = cls->batches[(cls->head + i) & cls->mask];
+    }
+    cls->batches.swap(ring);
+  }
+  catch (std::bad_alloc&) {
+    return false;
+  }
+
+  cls->head = 0;
+  cls->mask = new_size - 1;
+  counters.bytes_reserved += bytes;
+  return true;
+}
+
+int
+ParticlesSystem::
+place_particles(DurationClass *cls, int num_particles) noexcept {
+  ParticlesArena& arena = cls->arena;
+  int first = -1;
+
+  if (cls->num_batches == 0) {
+    arena.head = arena.tail = 0;
+  }
+
+  // Not wrapped: there's room after tail, and maybe before head.
+  if (cls->num_batches == 0 || arena.tail > arena.head) {
+    if (arena.capacity - arena.tail >= num_particles) {
+      first = arena.tail;
+    }
+    else if (arena.head >= num_particles) {
+      first = 0;
+    }
+  }
+  // Wrapped: there's only room between tail and head.
+  else if (arena.head - arena.tail >= num_particles) {
+    first = arena.tail;
+  }
+
+  if (first >= 0) {
+    arena.tail = first + num_particles;
+  }
+  return first;
+}
+
+bool
+ParticlesSystem::
+grow_arena(DurationClass *cls, int num_particles) noexcept {
+  ParticlesArena& arena = cls->arena;
+
+  int live = 0;
+  for (size_t i = 0; i < cls->num_batches; i++) {
+    live += padded_count(cls->batches[(cls->head + i) & cls->mask]->count,
+                         SIMD_WIDTH);
+  }
+
+  const int needed = live + num_particles;
+  const size_t budget_left = counters.bytes_budget - counters.bytes_reserved;
+  const size_t particles_left = std::min(budget_left/PARTICLE_BYTES,
+                                         size_t(INT_MAX/2));
+  const int affordable = arena.capacity +
+                         particles_left/SIMD_WIDTH*SIMD_WIDTH;
+
+  if (needed > affordable) {
+    return false;
+  }
+
+  int capacity = std::max(needed, arena.capacity*2);
+  capacity = std::max(capacity, int(MIN_ARENA_GROWTH));
+  capacity = std::min(capacity, affordable);
+
+  ParticlesArena grown;
+  const size_t num_lanes = capacity/SIMD_WIDTH;
+  auto resize = [num_lanes](auto& lanes) {
+    lanes.resize(num_lanes);
+  };
+
+  try {
+#if defined(PARTICLES_COMPACT)
+    resize(grown.rotation);
+#else
+    resize(grown.rot_cos);
+    resize(grown.rot_sin);
+#endif
+    resize(grown.vx);
+    resize(grown.vy);
+    resize(grown.pos_x);
+    resize(grown.pos_y);
+    vertices.resize((counters.particles_capacity +
+                     capacity - arena.capacity)*4);
+  }
+  catch (std::bad_alloc&) {
+    return false;
+  }
+
+  // Move the live batches to the start, in order, which unwraps the ring.
+  int tail = 0;
+  for (size_t i = 0; i < cls->num_batches; i++) {
+    ParticlesBatch *batch = cls->batches[(cls->head + i) & cls->mask];
+    const int padded = padded_count(batch->count, SIMD_WIDTH);
+    const int from = batch->first;
+    auto move = [from, padded, tail](auto& src, auto& dest) {
+      std::copy(elements(src) + from, elements(src) + from + padded,
+                elements(dest) + tail);
+    };
+#if defined(PARTICLES_COMPACT)
+    move(arena.rotation, grown.rotation);
+#else
+    move(arena.rot_cos, grown.rot_cos);
+    move(arena.rot_sin, grown.rot_sin);
+#endif
+    move(arena.vx, grown.vx);
+    move(arena.vy, grown.vy);
+    batch->first = tail;
+    tail += padded;
+  }
+
+#if defined(PARTICLES_COMPACT)
+  arena.rotation.swap(grown.rotation);
+#else
+  arena.rot_cos.swap(grown.rot_cos);
+  arena.rot_sin.swap(grown.rot_sin);
+#endif
+  arena.vx.swap(grown.vx);
+  arena.vy.swap(grown.vy);
+  arena.pos_x.swap(grown.pos_x);
+  arena.pos_y.swap(grown.pos_y);
+  arena.head = 0;
+  arena.tail = tail;
+
+  counters.bytes_reserved += (capacity - arena.capacity)*PARTICLE_BYTES;
+  counters.particles_capacity += capacity - arena.capacity;
+  arena.capacity = capacity;
+  return true;
+}
+
+int
+ParticlesSystem::
+reserve_batch(DurationClass *cls, int num_particles) noexcept {
+  if ((free_batches.empty() && !grow_batches()) ||
+      (cls->num_batches == cls->batches.size() && !grow_class_ring(cls)))
+  {
+    return -1;
+  }
+
+  int first = place_particles(cls, num_particles);
+  if (first < 0 && grow_arena(cls, num_particles)) {
+    first = place_particles(cls, num_particles);
+  }
+  return first;
+}
+
+void
+ParticlesSystem::
+pop_batch(DurationClass *cls) noexcept {
+  // There's room for every batch in free_batches, so this doesn't allocate.
+  free_batches.push_back(cls->batches[cls->head]);
+  cls->head = (cls->head + 1) & cls->mask;
+  cls->num_batches--;
+
+  if (cls->num_batches == 0) {
+    cls->arena.head = cls->arena.tail = 0;
+  }
+  else {
+    cls->arena.head = cls->batches[cls->head]->first;
+  }
+}
 
 void
 ParticlesSystem::
 add_batch(const ParticlesBatchSetup& setup) noexcept {
-  if (batches_used == PARTICLE_BATCHES_MAX) {
+  if (setup.num_particles <= 0) {
     return;
   }
 
-  auto& batch = batches[batches_used];
+  const int padded = padded_count(setup.num_particles, SIMD_WIDTH);
+
+  // If the budget is exhausted, memory held by classes that aren't in use
+  // anymore may do.
+  DurationClass *cls = class_for(setup.ms_duration);
+  int first = cls ? reserve_batch(cls, padded) : -1;
+  if (first < 0 && release_idle_classes(cls)) {
+    if (!cls) {
+      cls = class_for(setup.ms_duration);
+    }
+    first = cls ? reserve_batch(cls, padded) : -1;
+  }
+
+  if (first < 0) {
+    counters.batches_dropped++;
+    return;
+  }
+
+  ParticlesBatch *batch_ptr = free_batches.back();
+  free_batches.pop_back();
+  cls->batches[(cls->head + cls->num_batches) & cls->mask] = batch_ptr;
+  cls->num_batches++;
+
+  auto& batch = *batch_ptr;
+  batch.cls = cls;
   batch.img = setup.img;
-  batch.ms_duration = setup.ms_duration;
   batch.ms_start = setup.ms_start;
   batch.color = setup.color;
   batch.start_position = setup.start_position;
+  batch.drawn = 0;
+  batch.first = first;
+  batch.count = setup.num_particles;
 
   const float base_angle = setup.center_out_angle - setup.spread_angle*0.5f;
   const float d_vel = setup.ms_max_vel - setup.ms_min_vel;
 
-  for (auto& particle : batch.particles) {
-    const float angle = base_angle + RAND_01_f()*setup.spread_angle;
-    const float vel = setup.ms_min_vel + RAND_01_f()*d_vel;
-    particle = {
-      xMATH::Float2 {std::cos(angle)*vel, std::sin(angle)*vel},
-      float {RAND_01_f()*2.0f*xMATH::PI<float>()}
-    };
+  auto vx = elements(cls->arena.vx) + batch.first;
+  auto vy = elements(cls->arena.vy) + batch.first;
+#if defined(PARTICLES_COMPACT)
+  uint16_t *rotation = elements(cls->arena.rotation) + batch.first;
+
+  // Units as small as they can be, with no velocity out of range.
+  const float max_vel = std::max(std::fabs(setup.ms_min_vel),
+                                 std::fabs(setup.ms_max_vel));
+  batch.vel_unit = max_vel > 0.0f ? max_vel/VEL_UNITS : 1.0f;
+  const float vel_unit = batch.vel_unit;
+  const float units_per_vel = 1.0f/vel_unit;
+#else
+  float *rot_cos = elements(cls->arena.rot_cos) + batch.first;
+  float *rot_sin = elements(cls->arena.rot_sin) + batch.first;
+  const float vel_unit = 1.0f;
+#endif
+
+  // Random numbers are drawn a block at a time: 3 per particle.
+  float rand_01[3*SPAWN_BLOCK];
+  for (int block = 0; block < batch.count; block += SPAWN_BLOCK) {
+    const int n = std::min(int(SPAWN_BLOCK), batch.count - block);
+    rng.fill_01(rand_01, 3*n);
+
+    const float *rand_angle = rand_01;
+    const float *rand_vel = rand_01 + n;
+    const float *rand_rotation = rand_01 + 2*n;
+    for (int i = 0; i < n; i++) {
+      const float angle = base_angle + rand_angle[i]*setup.spread_angle;
+      const float vel = setup.ms_min_vel + rand_vel[i]*d_vel;
+#if defined(PARTICLES_COMPACT)
+      vx[block + i] = std::lrint(std::cos(angle)*vel*units_per_vel);
+      vy[block + i] = std::lrint(std::sin(angle)*vel*units_per_vel);
+      rotation[block + i] = uint16_t(rand_rotation[i]*65536.0f);
+#else
+      const float rotation = rand_rotation[i]*2.0f*xMATH::PI<float>();
+      vx[block + i] = std::cos(angle)*vel;
+      vy[block + i] = std::sin(angle)*vel;
+      rot_cos[block + i] = std::cos(rotation);
+      rot_sin[block + i] = std::sin(rotation);
+#endif
+    }
   }
 
-  batches_used++;
+  // Bounding circle of the velocities (as stored), around the middle of
+  // their bounding box.
+  const auto vx_range = std::minmax_element(vx, vx + batch.count);
+  const auto vy_range = std::minmax_element(vy, vy + batch.count);
+  const float vel_x = (float(*vx_range.first) + *vx_range.second)*0.5f;
+  const float vel_y = (float(*vy_range.first) + *vy_range.second)*0.5f;
+  float vel_radius_sq = 0.0f;
+  for (int i = 0; i < batch.count; i++) {
+    const float dx = vx[i] - vel_x;
+    const float dy = vy[i] - vel_y;
+    vel_radius_sq = std::max(vel_radius_sq, dx*dx + dy*dy);
+  }
+  batch.vel_center = xMATH::Float2 {vel_x, vel_y}*vel_unit;
+  batch.vel_radius = std::sqrt(vel_radius_sq)*vel_unit;
+
+  for (int i = batch.count; i < padded; i++) {
+    vx[i] = vy[i] = 0;
+#if defined(PARTICLES_COMPACT)
+    rotation[i] = 0;
+#else
+    rot_cos[i] = 1.0f;
+    rot_sin[i] = 0.0f;
+#endif
+  }
+
+  counters.batches_spawned++;
+  counters.batches_live++;
+  counters.batches_peak_live = std::max(counters.batches_peak_live,
+                                        counters.batches_live);
+  counters.particles_live += batch.count;
+  counters.particles_peak_live = std::max(counters.particles_peak_live,
+                                          counters.particles_live);
+}
+
+const ParticlesStats&
+ParticlesSystem::
+stats() const noexcept {
+  return counters;
 }
 
 void
 ParticlesSystem::
-update_and_render(GRAL::Screen *screen, uint32_t ms_now) {
-  int i = 0;
+update(const GRAL::Screen *screen, uint32_t ms_now) {
+  TRACE_Zone("ParticlesSystem::update");
+  // Batches of a class expire in order, so only the expired ones are
+  // touched. Nothing gets moved.
+  live_batches.clear();
+  int particles_live = 0;
+  for (auto& cls : classes) {
+    while (cls->num_batches > 0) {
+      const ParticlesBatch *oldest = cls->batches[cls->head];
+      if (!expired(oldest->ms_start, cls->ms_duration, ms_now) ||
+          pending(oldest->ms_start, ms_now))
+      {
+        break;
+      }
+      pop_batch(cls.get());
+    }
+
+    for (size_t i = 0; i < cls->num_batches; i++) {
+      ParticlesBatch *batch = cls->batches[(cls->head + i) & cls->mask];
+      if (expired(batch->ms_start, cls->ms_duration, ms_now)) {
+        continue;
+      }
+      // There's room for every batch, so this doesn't allocate.
+      live_batches.push_back(batch);
+      particles_live += batch->count;
+    }
+  }
+
+  const size_t num_live = live_batches.size();
+  batches_updated = num_live;
+  counters.batches_live = num_live;
+  counters.particles_live = particles_live;
+
+  // Batches simulate their quads into the quads range of their particles;
+  // the ones on screen get gathered afterwards.
+  int quads_end = 0;
+  for (size_t i = 0; i < num_live; i++) {
+    live_batches[i]->first_quad = quads_end;
+    quads_end += live_batches[i]->count;
+  }
+
+  // Split the live batches into tasks of roughly the same number of
+  // particles.
+  int num_tasks = 1;
+  if (pool) {
+    num_tasks = std::min(pool->size()*TASKS_PER_THREAD,
+                         particles_live/MIN_PARTICLES_PER_TASK);
+    num_tasks = std::max(num_tasks, 1);
+  }
+
+  task_bounds.resize(num_tasks + 1);
+  task_bounds[0] = 0;
+  const int particles_per_task = particles_live/num_tasks + 1;
+  int task = 1;
+  int task_particles = 0;
+  for (size_t i = 0; i < num_live && task < num_tasks; i++) {
+    task_particles += live_batches[i]->count;
+    if (task_particles >= particles_per_task) {
+      task_bounds[task++] = i + 1;
+      task_particles = 0;
+    }
+  }
+  while (task <= num_tasks) {
+    task_bounds[task++] = num_live;
+  }
+
+  if (num_tasks == 1) {
+    simulate(screen, ms_now, 0, num_live);
+  }
+  else {
+    pool->for_each(num_tasks, [=](int task) {
+      simulate(screen, ms_now, task_bounds[task], task_bounds[task + 1]);
+    });
+  }
+
+  // Close the gaps left by particles that weren't drawn, so render can draw
+  // runs of batches at once. Quads only ever move down.
+  int drawn_end = 0;
+  int batches_culled = 0;
+  for (size_t i = 0; i < num_live; i++) {
+    ParticlesBatch *batch = live_batches[i];
+    if (batch->drawn == 0) {
+      batches_culled++;
+    }
+    else if (batch->first_quad != drawn_end) {
+      xSDL::Vertex *quads = vertices.data() + batch->first_quad*4;
+      std::copy(quads, quads + batch->drawn*4,
+                vertices.data() + drawn_end*4);
+    }
+    batch->first_quad = drawn_end;
+    drawn_end += batch->drawn;
+  }
+  counters.particles_drawn = drawn_end;
+  counters.batches_culled = batches_culled;
+}
+
+void
+ParticlesSystem::
+simulate(const GRAL::Screen *screen, uint32_t ms_now,
+         size_t begin, size_t end) noexcept
+{
+  TRACE_Zone("ParticlesSystem::simulate");
+  const float screen_w = screen->width();
+  const float screen_h = screen->height();
 
-  while (i < batches_used) {
-    ParticlesBatch &batch = batches[i];
-    float dt = ms_now - batch.ms_start;
+  for (size_t i = begin; i < end; i++) {
+    ParticlesBatch *batch = live_batches[i];
+    const float dt = ms_now - batch->ms_start;
+    const int padded = padded_count(batch->count, SIMD_WIDTH);
 
-    if (dt > batch.ms_duration) {
-      batch = batches[batches_used-1];
-      batches_used--;
+    // Distance from the batch's bounding circle to the screen.
+    const float center_x = batch->start_position.x() +
+                           dt*batch->vel_center.x();
+    const float center_y = batch->start_position.y() +
+                           dt*batch->vel_center.y();
+    // Bounds the particle's image however it's rotated.
+    const float img_w = batch->img->width();
+    const float img_h = batch->img->height();
+    const float r = 0.5f*std::sqrt(img_w*img_w + img_h*img_h);
+
+    const float bound = dt*batch->vel_radius + r;
+    const float out_x = std::max(0.0f, std::max(-center_x,
+                                                center_x - screen_w));
+    const float out_y = std::max(0.0f, std::max(-center_y,
+                                                center_y - screen_h));
+    if (out_x*out_x + out_y*out_y >= bound*bound) {
+      batch->drawn = 0;
       continue;
     }
 
-    float t = dt / batch.ms_duration;
+    const bool all_inside = center_x - bound >= 0.0f &&
+                            center_x + bound <= screen_w &&
+                            center_y - bound >= 0.0f &&
+                            center_y + bound <= screen_h;
+
+    ParticlesArena& arena = batch->cls->arena;
+    float *pos_x = elements(arena.pos_x);
+    float *pos_y = elements(arena.pos_y);
+#if defined(PARTICLES_COMPACT)
+    const uint16_t *rotation = elements(arena.rotation);
+
+    eval_positions(elements(arena.vx) + batch->first,
+                   elements(arena.vy) + batch->first, padded,
+                   dt, batch->vel_unit, batch->start_position,
+                   pos_x + batch->first, pos_y + batch->first);
+#else
+    const float *rot_cos = elements(arena.rot_cos);
+    const float *rot_sin = elements(arena.rot_sin);
+
+    eval_positions(elements(arena.vx) + batch->first,
+                   elements(arena.vy) + batch->first, padded,
+                   dt, batch->start_position,
+                   pos_x + batch->first, pos_y + batch->first);
+#endif
+
+    const float t = dt / batch->cls->ms_duration;
 
     // -4t(t-1) goes from (0,0), (0.5, 1), (1, 0) in a quadratic fashion;
     // 0.5 being where it's at its max.
-    float fact = -t*(t-1.0f)*4.0f;
+    const float fact = -t*(t-1.0f)*4.0f;
 
-    GRAL::AlphaModGuard alpha_mod_guard(batch.img, fact*255);
-    GRAL::ColorModGuard color_mod_guard(batch.img, batch.color);
-    GRAL::BlendModeGuard blend_mode_guard(batch.img, SDL_BLENDMODE_ADD);
+    const xSDL::Color color {batch->color.r, batch->color.g, batch->color.b,
+                             static_cast<uint8_t>(fact*255)};
+    xSDL::Vertex *quads = vertices.data() + batch->first_quad*4;
+    xSDL::Vertex *quad = quads;
+    const int particles_end = batch->first + batch->count;
+    for (int j = batch->first; j < particles_end; j++) {
+      if (!all_inside &&
+          (pos_x[j] <= -r || pos_x[j] >= screen_w + r ||
+           pos_y[j] <= -r || pos_y[j] >= screen_h + r))
+      {
+        continue;
+      }
+#if defined(PARTICLES_COMPACT)
+      const xMATH::Float2 cos_sin = cos_table.cos_sin(rotation[j]);
+#else
+      const xMATH::Float2 cos_sin {rot_cos[j], rot_sin[j]};
+#endif
+      screen->image_quad(batch->img, xMATH::Float2 {pos_x[j], pos_y[j]},
+                         cos_sin, color, quad);
+      quad += 4;
+    }
+    batch->drawn = (quad - quads)/4;
+  }
+}
 
-    for (const auto& particle : batch.particles) {
-      xMATH::Float2 d_pos = dt*particle.vel;
-      xMATH::Float2 pos = batch.start_position + d_pos;
-      screen->draw_image(batch.img, pos, particle.angle);
+void
+ParticlesSystem::
+render(GRAL::Screen *screen) {
+  TRACE_Zone("ParticlesSystem::render");
+  // One call per run of consecutive batches sharing a texture (views of one
+  // atlas do); with a single texture, that's one call for everything.
+  size_t i = 0;
+  while (i < batches_updated) {
+    GRAL::Image *img = live_batches[i]->img;
+    const int first_quad = live_batches[i]->first_quad;
+    int num_quads = 0;
+    for (; i < batches_updated &&
+           live_batches[i]->img->shares_texture_with(img); i++)
+    {
+      num_quads += live_batches[i]->drawn;
+    }
+    if (num_quads == 0) {
+      continue;
     }
 
-    i++;
+    // Color and alpha are in the vertices.
+    GRAL::AlphaModGuard alpha_mod_guard(img, 255);
+    GRAL::ColorModGuard color_mod_guard(img, xSDL::WHITE);
+    GRAL::BlendModeGuard blend_mode_guard(img, SDL_BLENDMODE_ADD);
+    screen->draw_quads(img, vertices.data() + first_quad*4, num_quads);
   }
 }
 
+void
+ParticlesSystem::
+update_and_render(GRAL::Screen *screen, uint32_t ms_now) {
+  TRACE_Zone("ParticlesSystem::update_and_render");
+  update(screen, ms_now);
+  render(screen);
+}
+
 }
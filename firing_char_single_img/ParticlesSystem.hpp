@@ -2,10 +2,15 @@
 #define PARTICLES_SYSTEM_HPP
 
 #include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
 
 #include "xMath.hpp"
+#include "xRandom.hpp"
 #include "xSDL.hpp"
 #include "Graphical.hpp"
+#include "WorkerPool.hpp"
 
 namespace GAME {
 
@@ -19,37 +24,330 @@ struct ParticlesBatchSetup {
   Uint32 ms_start;
   Uint32 ms_duration;
   GRAL::Image *img;
+  int num_particles;
+};
+
+/**
+ * Counters kept by a ParticlesSystem since its creation. They're meant for
+ * sizing the memory budget from real sessions.
+ */
+struct ParticlesStats {
+  // Batches successfully added.
+  uint64_t batches_spawned;
+
+  // Batches that were asked for but couldn't be added because the memory
+  // budget was exhausted (or an allocation failed).
+  uint64_t batches_dropped;
+
+  int batches_live;
+  int batches_peak_live;
+
+  // Number of batches the currently reserved memory can hold.
+  int batches_capacity;
+
+  int particles_live;
+  int particles_peak_live;
+
+  // Of the particles simulated by the last update, how many were drawn, and
+  // how many batches were entirely off screen.
+  int particles_drawn;
+  int batches_culled;
+
+  // Number of particles the arenas can currently hold, all together.
+  int particles_capacity;
+
+  // Memory held for batches and particles, and how much it's allowed to grow
+  // to.
+  size_t bytes_reserved;
+  size_t bytes_budget;
 };
 
 class ParticlesSystem {
 public:
-  ParticlesSystem() noexcept;
+  enum : size_t {
+    DEFAULT_MEMORY_BUDGET = size_t(4) << 20
+  };
+
+  /**
+   * Storage for batches and particles is reserved as needed, and it never
+   * goes over `memory_budget` bytes. Once it's all in use, new batches are
+   * dropped (and counted as such in stats()).
+   *
+   * If a `pool` is given, update spreads the simulation over its threads.
+   *
+   * Particles are spawned with a generator of its own, seeded with `seed`.
+   * The same seed and the same calls give the same particles.
+   */
+  explicit ParticlesSystem(uint64_t seed,
+                           size_t memory_budget = DEFAULT_MEMORY_BUDGET,
+                           WORK::Pool *pool = nullptr);
+
+  /**
+   * Restarts the particles' random sequence. Live particles aren't
+   * affected.
+   */
+  void
+  reseed(uint64_t seed) noexcept;
 
   void
   add_batch(const ParticlesBatchSetup& setup) noexcept;
 
+  /**
+   * Drops expired batches and computes where every live particle goes and
+   * how it looks at `ms_now`, as quads for `screen`. Nothing is drawn.
+   *
+   * Batches starting after ms_now are kept, but not drawn until they start,
+   * so it's fine to update at a time a bit behind the last batches added.
+   */
+  void
+  update(const GRAL::Screen *screen, uint32_t ms_now);
+
+  /**
+   * Draws the quads computed by the last update. Batches added after it
+   * aren't drawn until the next one.
+   */
+  void
+  render(GRAL::Screen *screen);
+
   void
   update_and_render(GRAL::Screen *screen, uint32_t ms_now);
 
+  const ParticlesStats&
+  stats() const noexcept;
+
 private:
   enum {
-    PARTICLE_BATCHES_MAX = 1 << 8,
-    PARTICLES_PER_BATCH = 30,
+    BATCHES_PER_CHUNK = 1 << 6,
+
+    // Number of floats processed at once by the positions kernel. Each
+    // batch's range in the arena starts at a multiple of it and is padded to
+    // a multiple of it, so the kernel never has to deal with a scalar tail.
+    SIMD_WIDTH = 4,
+
+    // add_batch draws random numbers for this many particles at a time.
+    SPAWN_BLOCK = 1 << 6,
+
+    // An arena never grows by less than this many particles.
+    MIN_ARENA_GROWTH = 1 << 8,
+
+    // Initial number of slots in a class's ring of batches.
+    MIN_CLASS_RING = 1 << 4,
+
+    // Below this, handing particles to another thread costs more than
+    // simulating them.
+    MIN_PARTICLES_PER_TASK = 1 << 11,
+
+    // Tasks per thread of the pool. More than one evens out threads that
+    // get descheduled.
+    TASKS_PER_THREAD = 2,
   };
 
-  struct ParticlesBatch {
+  struct DurationClass;
+
+  /**
+   * A batch's particles are the `count` particles starting at `first` in its
+   * class's arena. The `drawn` ones that are on screen have their quads
+   * starting at quad `first_quad` in vertices.
+   *
+   * Every particle's velocity is within `vel_radius` of `vel_center`, so dt
+   * ms after the start, the particles are all within a circle of radius
+   * dt*vel_radius around start_position + dt*vel_center.
+   *
+   * It's kept to a cache line, and aligned on one: simulating a batch reads
+   * all of it.
+   */
+  struct alignas(64) ParticlesBatch {
+    DurationClass *cls;
     GRAL::Image *img;
     xMATH::Float2 start_position;
-    uint32_t ms_duration, ms_start;
+    uint32_t ms_start;
     xSDL::Color color;
-    struct {
-      xMATH::Float2 vel;
-      float angle;
-    } particles[PARTICLES_PER_BATCH];
+    xMATH::Float2 vel_center;
+    float vel_radius;
+
+#if defined(PARTICLES_COMPACT)
+    // The velocity of a unit of the quantized velocities.
+    float vel_unit;
+#endif
+
+    int first;
+    int count;
+    int first_quad;
+    int drawn;
+  };
+
+  static_assert(sizeof (ParticlesBatch) == 64 &&
+                alignof (ParticlesBatch) == 64,
+                "A particles batch should be a cache line");
+
+  /**
+   * Chunks of batches are allocated aligned by hand, since new doesn't
+   * honor alignments this large before C++17.
+   */
+  struct FreeBatchesChunk {
+    void
+    operator()(ParticlesBatch *chunk) const noexcept;
   };
 
-  ParticlesBatch batches[PARTICLE_BATCHES_MAX];
-  int batches_used;
+  // A SIMD register worth of values. Vectors of these give us aligned
+  // arrays.
+  template<typename T>
+  struct alignas(sizeof (T)*SIMD_WIDTH) Lanes {
+    T v[SIMD_WIDTH];
+  };
+
+  /**
+   * Particles of a duration class, stored as a structure of arrays so the
+   * velocity components are contiguous and can be loaded straight into SIMD
+   * registers. Padding lanes hold zero velocities and are never drawn.
+   *
+   * The rotation of each particle never changes. Normally its cosine and
+   * sine are computed once, when the batch is added. With PARTICLES_COMPACT
+   * defined, particles are quantized to 6 bytes instead of 16: velocities
+   * are 16 bits fixed point numbers (in units of the batch's vel_unit), and
+   * the rotation is a 16 bits binary angle, looked up in a table when drawn.
+   *
+   * It's a ring: batches own contiguous ranges, laid out from `head` (the
+   * oldest batch's) to `tail` in spawn order. A batch that doesn't fit before
+   * the end goes at 0, and the space it skipped is reclaimed once the head
+   * wraps too. Particles are never moved, except when the ring grows.
+   */
+  struct ParticlesArena {
+#if defined(PARTICLES_COMPACT)
+    std::vector<Lanes<int16_t>> vx;
+    std::vector<Lanes<int16_t>> vy;
+    std::vector<Lanes<uint16_t>> rotation;
+#else
+    std::vector<Lanes<float>> vx;
+    std::vector<Lanes<float>> vy;
+    std::vector<Lanes<float>> rot_cos;
+    std::vector<Lanes<float>> rot_sin;
+#endif
+
+    // Filled by the positions kernel before anything gets drawn.
+    std::vector<Lanes<float>> pos_x;
+    std::vector<Lanes<float>> pos_y;
+
+    int head, tail;
+    int capacity;
+  };
+
+  /**
+   * Batches sharing a duration. Batches are added with a start time that
+   * doesn't go back, so they expire in the same order they were added, and
+   * a queue is all it takes: expiring is popping from the front.
+   *
+   * If a batch does start before the one added before it, it's simply
+   * skipped once expired, and freed when it gets to the front.
+   */
+  struct DurationClass {
+    uint32_t ms_duration;
+
+    // Ring of batches. The oldest one is at head, and the mask is the ring's
+    // size (a power of 2) minus 1.
+    std::vector<ParticlesBatch*> batches;
+    size_t head, num_batches, mask;
+
+    ParticlesArena arena;
+  };
+
+  /**
+   * Finds the class for batches lasting `ms_duration`, reusing an empty class
+   * or creating one if there's none. Returns null if the budget doesn't
+   * allow for another class.
+   */
+  DurationClass*
+  class_for(uint32_t ms_duration) noexcept;
+
+  /**
+   * Frees the classes with no batches, other than `keep`. Returns whether any
+   * memory was freed.
+   */
+  bool
+  release_idle_classes(const DurationClass *keep) noexcept;
+
+  /**
+   * Makes room in the class's ring for one more batch, if the budget allows
+   * it.
+   */
+  bool
+  grow_class_ring(DurationClass *cls) noexcept;
+
+  /**
+   * Makes room in the class for a batch of `num_particles` (a multiple of
+   * SIMD_WIDTH) particles, and a batch for it in the pool, growing whatever
+   * needs to if the budget allows it. Returns where the particles go in the
+   * class's arena, or -1 if there isn't room.
+   */
+  int
+  reserve_batch(DurationClass *cls, int num_particles) noexcept;
+
+  /**
+   * Removes the oldest batch of a class and gives it back to the pool.
+   */
+  void
+  pop_batch(DurationClass *cls) noexcept;
+
+  /**
+   * Reserves one more chunk of batches if the budget allows it. Returns false
+   * if it doesn't, or if memory couldn't be allocated.
+   */
+  bool
+  grow_batches() noexcept;
+
+  /**
+   * Finds room for `num_particles` (a multiple of SIMD_WIDTH) at the tail of
+   * the class's arena, and returns where it starts. Returns -1 if there's no
+   * room.
+   */
+  static int
+  place_particles(DurationClass *cls, int num_particles) noexcept;
+
+  /**
+   * Grows the class's arena so it has room for at least `num_particles` more
+   * particles, if the budget allows it. Live batches are moved to the start,
+   * in order. Returns false if the budget doesn't allow it, or if memory
+   * couldn't be allocated.
+   */
+  bool
+  grow_arena(DurationClass *cls, int num_particles) noexcept;
+
+  /**
+   * Computes the positions and quads of the live batches in [begin, end).
+   * Batches whose bounding circle is off screen are skipped altogether, and
+   * particles off screen get no quad. Batches don't share anything they
+   * write, so disjoint ranges can be simulated by different threads.
+   */
+  void
+  simulate(const GRAL::Screen *screen, uint32_t ms_now,
+           size_t begin, size_t end) noexcept;
+
+  // Batches live in fixed size chunks, so they never move once added.
+  std::vector<std::unique_ptr<ParticlesBatch[], FreeBatchesChunk>> chunks;
+  std::vector<ParticlesBatch*> free_batches;
+
+  std::vector<std::unique_ptr<DurationClass>> classes;
+
+  // The batches to simulate and draw, as of the last update: class after
+  // class, each one's in spawn order.
+  std::vector<ParticlesBatch*> live_batches;
+
+  // Quads for every live particle, in the same order as live_batches. It
+  // has room for the particles of every arena.
+  std::vector<xSDL::Vertex> vertices;
+
+  WORK::Pool *pool;
+
+  xMATH::Random rng;
+
+  // Task i of the simulation takes the live batches in
+  // [task_bounds[i], task_bounds[i+1]).
+  std::vector<size_t> task_bounds;
+
+  // How many of the live batches (the first ones) the last update covered.
+  size_t batches_updated;
+
+  ParticlesStats counters;
 };
 
 }
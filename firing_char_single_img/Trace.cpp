@@ -0,0 +1,162 @@
+#include "Trace.hpp"
+
+#if defined(TRACE_ENABLED)
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace TRACE {
+
+namespace {
+
+struct Event {
+  const char *name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+};
+
+/**
+ * Zones recorded by a thread. Only that thread touches it, until the trace
+ * is written.
+ */
+struct ThreadBuffer {
+  int tid;
+  const char *name;
+  std::vector<Event> events;
+  uint64_t dropped;
+};
+
+const std::chrono::steady_clock::time_point trace_start =
+  std::chrono::steady_clock::now();
+
+// Every thread's buffer. Buffers outlive their threads, so the zones of
+// threads that are gone still get written.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+thread_local ThreadBuffer *thread_buffer = nullptr;
+
+ThreadBuffer*
+this_thread_buffer() {
+  if (!thread_buffer) {
+    std::unique_ptr<ThreadBuffer> buffer {new ThreadBuffer()};
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffer->tid = buffers.size() + 1;
+    buffer->name = nullptr;
+    buffer->dropped = 0;
+    buffers.push_back(std::move(buffer));
+    thread_buffer = buffers.back().get();
+  }
+  return thread_buffer;
+}
+
+/**
+ * Writes `s` as a JSON string.
+ */
+void
+write_string(std::ostream &out, const char *s) {
+  out << '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      out << '\\';
+    }
+    out << *s;
+  }
+  out << '"';
+}
+
+/**
+ * Writes `ns` in us, which is the format's time unit.
+ */
+void
+write_us(std::ostream &out, uint64_t ns) {
+  const uint64_t frac = ns % 1000;
+  out << ns/1000 << '.'
+      << char('0' + frac/100) << char('0' + frac/10 % 10)
+      << char('0' + frac % 10);
+}
+
+} // end of anonymous
+
+uint64_t
+now_ns() noexcept {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now() -
+                                    trace_start).count();
+}
+
+void
+record(const char *name, uint64_t start_ns, uint64_t end_ns) noexcept {
+  try {
+    ThreadBuffer *buffer = this_thread_buffer();
+    if (buffer->events.size() >= MAX_EVENTS_PER_THREAD) {
+      buffer->dropped++;
+      return;
+    }
+    buffer->events.push_back({name, start_ns, end_ns - start_ns});
+  }
+  catch (...) {
+    // A zone missing from the trace is better than no trace at all.
+  }
+}
+
+void
+set_thread_name(const char *name) noexcept {
+  try {
+    ThreadBuffer *buffer = this_thread_buffer();
+    // Threads may name themselves before their first sync with the one
+    // writing the trace.
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffer->name = name;
+  }
+  catch (...) {
+    // The thread just goes unnamed.
+  }
+}
+
+bool
+write(const char *file_name) {
+  std::ofstream out {file_name};
+
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  bool first = true;
+  for (const std::unique_ptr<ThreadBuffer> &buffer : buffers) {
+    if (buffer->name) {
+      out << (first ? "\n" : ",\n")
+          << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+          << "\"tid\": " << buffer->tid << ", \"args\": {\"name\": ";
+      write_string(out, buffer->name);
+      out << "}}";
+      first = false;
+    }
+    for (const Event &event : buffer->events) {
+      out << (first ? "\n" : ",\n") << "{\"ph\": \"X\", \"name\": ";
+      write_string(out, event.name);
+      out << ", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": ";
+      write_us(out, event.start_ns);
+      out << ", \"dur\": ";
+      write_us(out, event.duration_ns);
+      out << "}";
+      first = false;
+    }
+    if (buffer->dropped) {
+      // Marks where the buffer filled up.
+      out << ",\n{\"ph\": \"i\", \"s\": \"t\", \"name\": \"zones dropped\", "
+          << "\"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": ";
+      write_us(out, buffer->events.back().start_ns);
+      out << ", \"args\": {\"count\": " << buffer->dropped << "}}";
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+  return bool(out);
+}
+
+} // end of trace
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/**
+ * Timeline tracing, in Chrome's trace event format (which Perfetto and
+ * chrome://tracing open). It's compiled in only if TRACE_ENABLED is defined
+ * (make CXX_DEFS=-DTRACE_ENABLED); otherwise the macros below expand to
+ * nothing.
+ *
+ * - TRACE_Zone(name) times the rest of the enclosing scope as a zone called
+ * `name`, which must be a string literal (or live as long).
+ *
+ * - TRACE_ThreadName(name) names the calling thread in the trace.
+ *
+ * - TRACE_Write(file_name) writes every zone recorded so far into a JSON
+ * file. No other thread should be recording zones meanwhile.
+ *
+ * Each thread records its zones into a buffer of its own, so recording takes
+ * no lock. A buffer holds up to MAX_EVENTS_PER_THREAD zones; later ones are
+ * counted, but dropped.
+ */
+
+#if defined(TRACE_ENABLED)
+
+#include <cstddef>
+#include <cstdint>
+
+namespace TRACE {
+
+enum : size_t {
+  MAX_EVENTS_PER_THREAD = size_t(1) << 20
+};
+
+/**
+ * Time since tracing started.
+ */
+uint64_t
+now_ns() noexcept;
+
+void
+record(const char *name, uint64_t start_ns, uint64_t end_ns) noexcept;
+
+void
+set_thread_name(const char *name) noexcept;
+
+/**
+ * Returns false if the file couldn't be written.
+ */
+bool
+write(const char *file_name);
+
+class Zone {
+public:
+  explicit Zone(const char *name) noexcept
+    : name {name}, start_ns {now_ns()}
+  {}
+
+  ~Zone() {
+    record(name, start_ns, now_ns());
+  }
+
+  Zone(const Zone&) = delete;
+  Zone& operator=(const Zone&) = delete;
+
+private:
+  const char *name;
+  uint64_t start_ns;
+};
+
+} // end of trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_Zone(name) TRACE::Zone TRACE_CONCAT(trace_zone_, __LINE__) {name}
+#define TRACE_ThreadName(name) TRACE::set_thread_name(name)
+#define TRACE_Write(file_name) TRACE::write(file_name)
+
+#else
+
+#define TRACE_Zone(name)
+#define TRACE_ThreadName(name)
+#define TRACE_Write(file_name)
+
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
+
+namespace WORK {
+
+Pool::
+Pool(int num_workers)
+  : job_generation {0},
+    workers_busy {0},
+    quitting {false},
+    job_fn {nullptr},
+    job_ctx {nullptr},
+    job_num_tasks {0},
+    next_task {0}
+{
+  workers.reserve(std::max(num_workers, 0));
+  try {
+    for (int i = 0; i < num_workers; i++) {
+      workers.emplace_back(&Pool::work_loop, this);
+    }
+  }
+  catch (...) {
+    stop();
+    throw;
+  }
+}
+
+Pool::
+~Pool() {
+  stop();
+}
+
+void
+Pool::
+stop() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quitting = true;
+  }
+  job_posted.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+int
+Pool::
+default_num_workers() noexcept {
+  // hardware_concurrency may not know, in which case it says 0.
+  const int cores = std::thread::hardware_concurrency();
+  return std::max(cores - 1, 0);
+}
+
+int
+Pool::
+size() const noexcept {
+  return workers.size() + 1;
+}
+
+void
+Pool::
+run(int num_tasks, TaskFn fn, void *ctx) {
+  if (num_tasks <= 0) {
+    return;
+  }
+
+  if (workers.empty() || num_tasks == 1) {
+    for (int task = 0; task < num_tasks; task++) {
+      fn(ctx, task);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job_fn = fn;
+    job_ctx = ctx;
+    job_num_tasks = num_tasks;
+    next_task.store(0, std::memory_order_relaxed);
+    workers_busy = workers.size();
+    job_generation++;
+  }
+  job_posted.notify_all();
+
+  take_tasks();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  job_done.wait(lock, [this] { return workers_busy == 0; });
+}
+
+void
+Pool::
+take_tasks() noexcept {
+  for (;;) {
+    const int task = next_task.fetch_add(1, std::memory_order_relaxed);
+    if (task >= job_num_tasks) {
+      return;
+    }
+    job_fn(job_ctx, task);
+  }
+}
+
+void
+Pool::
+work_loop() {
+  TRACE_ThreadName("worker");
+  unsigned seen_generation = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_posted.wait(lock, [&] {
+        return quitting || job_generation != seen_generation;
+      });
+      if (quitting) {
+        return;
+      }
+      seen_generation = job_generation;
+    }
+
+    take_tasks();
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      last = --workers_busy == 0;
+    }
+    if (last) {
+      job_done.notify_one();
+    }
+  }
+}
+
+} // end of work
@@ -0,0 +1,101 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WORK {
+
+/**
+ * A fixed set of threads for splitting a piece of work into independent
+ * tasks. The thread calling for_each works on the tasks too, so a pool of
+ * size() 1 has no workers and just runs everything on the calling thread.
+ *
+ * The pool isn't meant to be used from more than one thread at once.
+ */
+class Pool {
+public:
+  /**
+   * Starts `num_workers` threads besides the calling one. Use
+   * default_num_workers() to have one thread per core.
+   */
+  explicit Pool(int num_workers);
+
+  ~Pool();
+
+  Pool(const Pool&) = delete;
+  Pool& operator=(const Pool&) = delete;
+
+  /**
+   * Number of workers that leave one core to each other thread, with the
+   * calling thread counting as one.
+   */
+  static int
+  default_num_workers() noexcept;
+
+  /**
+   * Number of threads working on the tasks, calling thread included.
+   */
+  int
+  size() const noexcept;
+
+  /**
+   * Calls fn(task) for every task in [0, num_tasks), each one on whichever
+   * thread gets to it first, and returns once all of them are done.
+   *
+   * @note fn must not throw.
+   */
+  template<typename Fn>
+  void
+  for_each(int num_tasks, Fn&& fn) {
+    run(num_tasks, [](void *ctx, int task) {
+      (*static_cast<Fn*>(ctx))(task);
+    }, &fn);
+  }
+
+private:
+  typedef void (*TaskFn)(void *ctx, int task);
+
+  void
+  run(int num_tasks, TaskFn fn, void *ctx);
+
+  void
+  work_loop();
+
+  /**
+   * Tells the workers to quit and waits for them.
+   */
+  void
+  stop() noexcept;
+
+  /**
+   * Runs tasks of the current job until there are none left to be taken.
+   */
+  void
+  take_tasks() noexcept;
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable job_posted;
+  std::condition_variable job_done;
+
+  // Guarded by mutex.
+  unsigned job_generation;
+  int workers_busy;
+  bool quitting;
+
+  // The current job. Written before it's posted (under the mutex), only read
+  // afterwards.
+  TaskFn job_fn;
+  void *job_ctx;
+  int job_num_tasks;
+  std::atomic<int> next_task;
+};
+
+} // end of work
+
+#endif
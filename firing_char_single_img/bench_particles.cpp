@@ -0,0 +1,414 @@
+/**
+ * Headless benchmark of GAME::ParticlesSystem.
+ *
+ * Each scenario drives a fresh particles system with a scripted spawn
+ * pattern, on a virtual clock advancing FRAME_MS per frame, and draws into an
+ * offscreen surface through SDL's software renderer. No window is created, so
+ * it runs anywhere SDL does. The particles system is seeded with --seed, and
+ * spawns come from a generator split off a generator seeded with it, so a
+ * given seed always yields the same workload, and the workload's random
+ * numbers aren't the ones the particles get.
+ *
+ * Usage: bench_particles [--frames N] [--seed S] [--threads T]
+ *                        [--scenario bursts|cone|saturation]
+ *
+ * --threads 0 (the default) runs the simulation on the calling thread only.
+ * Results are printed to stdout as JSON.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "xSDL.hpp"
+#include "Graphical.hpp"
+#include "ParticlesSystem.hpp"
+#include "WorkerPool.hpp"
+#include "xMath.hpp"
+#include "xRandom.hpp"
+
+using xMATH::Float2;
+using xMATH::PI;
+
+namespace BENCH {
+
+enum {
+  SCREEN_WIDTH = 800,
+  SCREEN_HEIGHT = 600,
+  PARTICLE_SIDE = 18,
+
+  FRAME_MS = 16,
+
+  // Frames run before measuring, so the system starts from steady state.
+  WARMUP_FRAMES = 120,
+  DEFAULT_FRAMES = 1200,
+
+  // sparts003 draws up to this many random batches per frame.
+  BURSTS_MAX = 256,
+
+  // Shooters firing like EngCharacter, spread around the screen.
+  CONE_SHOOTERS = 8,
+  CONE_SHOT_MS = 50,
+
+  // Spawns per frame are capped, so saturation can't spin forever if the
+  // budget is large.
+  SATURATION_MAX_SPAWNS = 4096,
+  SATURATION_PARTICLES = 64
+};
+
+/**
+ * What a spawn pattern gets to work with.
+ */
+struct Workload {
+  GAME::ParticlesSystem *particles;
+  GRAL::Image *img;
+  xMATH::Random *rng;
+};
+
+/**
+ * sparts003's GenParticlesBatch and GenFixedFire: random bursts all over the
+ * screen, and a fire at a fixed spot 30% of the frames.
+ */
+static void
+spawn_bursts(Workload *w, uint32_t ms_now) {
+  GAME::ParticlesBatchSetup setup;
+  setup.img = w->img;
+  setup.ms_start = ms_now;
+  setup.num_particles = 30;
+
+  int num_bursts = w->rng->uniform_01()*BURSTS_MAX*0.004f;
+  for (int i = 0; i < num_bursts; i++) {
+    setup.start_position = Float2{SCREEN_WIDTH*w->rng->uniform_01(),
+                                  SCREEN_HEIGHT*w->rng->uniform_01()};
+    setup.center_out_angle = w->rng->uniform_01()*PI<float>()*2.0f;
+    setup.spread_angle = PI<float>()*0.8f;
+    setup.ms_min_vel = 0.0f;
+    setup.ms_max_vel = 0.03f;
+    setup.color = xSDL::Color(255*w->rng->uniform_01(),
+                              255*w->rng->uniform_01(),
+                              255*w->rng->uniform_01());
+    setup.ms_duration = 500;
+    w->particles->add_batch(setup);
+  }
+
+  if (w->rng->uniform_01() < 0.3f) {
+    setup.start_position = Float2{400.0f, 300.0f};
+    setup.center_out_angle = PI<float>()/4.0f;
+    setup.spread_angle = PI<float>()*0.1f;
+    setup.ms_min_vel = 0.0f;
+    setup.ms_max_vel = 0.2f;
+    setup.color = xSDL::Color(64 + 32*w->rng->uniform_01(),
+                              24 + 12*w->rng->uniform_01(),
+                              12);
+    setup.ms_duration = 1200;
+    w->particles->add_batch(setup);
+  }
+}
+
+/**
+ * EngCharacter::fire, from shooters sweeping their aim: one batch per shooter
+ * every CONE_SHOT_MS.
+ */
+static void
+spawn_cone(Workload *w, uint32_t ms_now) {
+  if (ms_now % CONE_SHOT_MS >= FRAME_MS) {
+    return;
+  }
+
+  GAME::ParticlesBatchSetup setup;
+  setup.spread_angle = PI<float>()*0.01f;
+  setup.ms_min_vel = 0.05f;
+  setup.ms_max_vel = 0.3f;
+  setup.color = {255, 85, 24, 255};
+  setup.ms_start = ms_now;
+  setup.ms_duration = 1000;
+  setup.img = w->img;
+  setup.num_particles = 30;
+
+  for (int i = 0; i < CONE_SHOOTERS; i++) {
+    const float around = i*PI<float>()*2.0f/CONE_SHOOTERS;
+    setup.start_position = Float2{SCREEN_WIDTH*0.5f, SCREEN_HEIGHT*0.5f} +
+                           Float2{std::cos(around), std::sin(around)}*200.0f;
+    setup.center_out_angle = around + std::sin(ms_now*0.001f + i);
+    w->particles->add_batch(setup);
+  }
+}
+
+/**
+ * Long lived batches added until the memory budget runs out, every frame.
+ */
+static void
+spawn_saturation(Workload *w, uint32_t ms_now) {
+  GAME::ParticlesBatchSetup setup;
+  setup.spread_angle = PI<float>()*2.0f;
+  setup.ms_min_vel = 0.0f;
+  setup.ms_max_vel = 0.1f;
+  setup.color = xSDL::WHITE;
+  setup.ms_start = ms_now;
+  setup.ms_duration = 3000;
+  setup.img = w->img;
+  setup.num_particles = SATURATION_PARTICLES;
+
+  const uint64_t dropped = w->particles->stats().batches_dropped;
+  for (int i = 0; i < SATURATION_MAX_SPAWNS; i++) {
+    setup.start_position = Float2{SCREEN_WIDTH*w->rng->uniform_01(),
+                                  SCREEN_HEIGHT*w->rng->uniform_01()};
+    setup.center_out_angle = w->rng->uniform_01()*PI<float>()*2.0f;
+    w->particles->add_batch(setup);
+    if (w->particles->stats().batches_dropped != dropped) {
+      break;
+    }
+  }
+}
+
+struct Scenario {
+  const char *name;
+  void (*spawn)(Workload *w, uint32_t ms_now);
+};
+
+static const Scenario SCENARIOS[] {
+  {"bursts", spawn_bursts},
+  {"cone", spawn_cone},
+  {"saturation", spawn_saturation}
+};
+
+struct Options {
+  int frames;
+  uint64_t seed;
+  int threads;
+
+  // Null for all of them.
+  const char *scenario;
+};
+
+struct Results {
+  std::vector<uint64_t> update_ns;
+  std::vector<uint64_t> render_ns;
+  std::vector<uint64_t> frame_ns;
+  uint64_t batches;
+  uint64_t particles;
+  uint64_t particles_drawn;
+  uint64_t batches_culled;
+  uint64_t batches_dropped;
+  int particles_peak_live;
+};
+
+static uint64_t
+elapsed_ns(std::chrono::steady_clock::time_point since) {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now() - since).count();
+}
+
+static Results
+run_scenario(const Scenario &scenario, const Options &opts,
+             xSDL::Renderer *rend, GRAL::Screen *screen, GRAL::Image *img,
+             WORK::Pool *pool)
+{
+  using GAME::ParticlesSystem;
+  ParticlesSystem particles {opts.seed,
+                             ParticlesSystem::DEFAULT_MEMORY_BUDGET, pool};
+  xMATH::Random rng = xMATH::Random(opts.seed).split();
+  Workload workload {&particles, img, &rng};
+
+  Results res {};
+  res.update_ns.reserve(opts.frames);
+  res.render_ns.reserve(opts.frames);
+  res.frame_ns.reserve(opts.frames);
+
+  uint32_t ms_now = 0;
+  for (int frame = -WARMUP_FRAMES; frame < opts.frames; frame++) {
+    ms_now += FRAME_MS;
+
+    rend->set_draw_color(xSDL::BLACK);
+    rend->clear();
+
+    auto start = std::chrono::steady_clock::now();
+    scenario.spawn(&workload, ms_now);
+    auto update_start = std::chrono::steady_clock::now();
+    particles.update(screen, ms_now);
+    const uint64_t update_ns = elapsed_ns(update_start);
+    auto render_start = std::chrono::steady_clock::now();
+    particles.render(screen);
+    const uint64_t render_ns = elapsed_ns(render_start);
+    const uint64_t frame_ns = elapsed_ns(start);
+
+    if (frame >= 0) {
+      const GAME::ParticlesStats &stats = particles.stats();
+      res.update_ns.push_back(update_ns);
+      res.render_ns.push_back(render_ns);
+      res.frame_ns.push_back(frame_ns);
+      res.batches += stats.batches_live;
+      res.particles += stats.particles_live;
+      res.particles_drawn += stats.particles_drawn;
+      res.batches_culled += stats.batches_culled;
+    }
+  }
+
+  res.batches_dropped = particles.stats().batches_dropped;
+  res.particles_peak_live = particles.stats().particles_peak_live;
+  return res;
+}
+
+/**
+ * Prints the mean, a few percentiles (nearest rank) and the max of `ns`.
+ */
+static void
+print_distribution(const char *name, std::vector<uint64_t> ns) {
+  std::sort(ns.begin(), ns.end());
+
+  uint64_t sum = 0;
+  for (uint64_t v : ns) {
+    sum += v;
+  }
+
+  auto percentile = [&ns](int p) -> uint64_t {
+    if (ns.empty()) {
+      return 0;
+    }
+    size_t rank = (ns.size()*p + 99)/100;
+    return ns[rank ? rank - 1 : 0];
+  };
+
+  std::cout << "      \"" << name << "\": {"
+            << "\"mean\": " << (ns.empty() ? 0 : sum/ns.size())
+            << ", \"p50\": " << percentile(50)
+            << ", \"p90\": " << percentile(90)
+            << ", \"p99\": " << percentile(99)
+            << ", \"max\": " << (ns.empty() ? 0 : ns.back())
+            << "}";
+}
+
+static void
+print_results(const char *name, const Results &res, int frames, bool last) {
+  uint64_t total_ns = 0;
+  for (uint64_t v : res.frame_ns) {
+    total_ns += v;
+  }
+
+  std::cout << "    {\n"
+            << "      \"name\": \"" << name << "\",\n"
+            << "      \"batches_per_frame\": "
+            << double(res.batches)/frames << ",\n"
+            << "      \"particles_per_frame\": "
+            << double(res.particles)/frames << ",\n"
+            << "      \"particles_drawn_per_frame\": "
+            << double(res.particles_drawn)/frames << ",\n"
+            << "      \"batches_culled_per_frame\": "
+            << double(res.batches_culled)/frames << ",\n"
+            << "      \"particles_peak_live\": "
+            << res.particles_peak_live << ",\n"
+            << "      \"batches_dropped\": " << res.batches_dropped << ",\n"
+            << "      \"ns_per_particle\": "
+            << (res.particles ? double(total_ns)/res.particles : 0.0)
+            << ",\n";
+  print_distribution("update_ns", res.update_ns);
+  std::cout << ",\n";
+  print_distribution("render_ns", res.render_ns);
+  std::cout << ",\n";
+  print_distribution("frame_ns", res.frame_ns);
+  std::cout << "\n    }" << (last ? "" : ",") << "\n";
+}
+
+static bool
+parse_options(int argc, char **argv, Options *opts) {
+  opts->frames = DEFAULT_FRAMES;
+  opts->seed = 1;
+  opts->threads = 0;
+  opts->scenario = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc) {
+      return false;
+    }
+    const char *value = argv[i+1];
+    if (std::strcmp(argv[i], "--frames") == 0) {
+      opts->frames = std::atoi(value);
+    }
+    else if (std::strcmp(argv[i], "--seed") == 0) {
+      opts->seed = std::strtoull(value, nullptr, 10);
+    }
+    else if (std::strcmp(argv[i], "--threads") == 0) {
+      opts->threads = std::atoi(value);
+    }
+    else if (std::strcmp(argv[i], "--scenario") == 0) {
+      opts->scenario = value;
+    }
+    else {
+      return false;
+    }
+    i++;
+  }
+
+  return opts->frames > 0 && opts->threads >= 0;
+}
+
+static int
+run(const Options &opts) {
+  xSDL::SDL sdl {0};
+  xSDL::Surface target {SCREEN_WIDTH, SCREEN_HEIGHT};
+  xSDL::Renderer rend {&target};
+  GRAL::Screen screen {&rend, SCREEN_WIDTH, SCREEN_HEIGHT};
+
+  xSDL::Surface particle_surf {PARTICLE_SIDE, PARTICLE_SIDE};
+  particle_surf.fill(xSDL::WHITE);
+  GRAL::Image img {&screen, &particle_surf};
+
+  std::unique_ptr<WORK::Pool> pool;
+  if (opts.threads > 0) {
+    pool.reset(new WORK::Pool(opts.threads - 1));
+  }
+
+  std::vector<const Scenario*> selected;
+  for (const Scenario &scenario : SCENARIOS) {
+    if (!opts.scenario || std::strcmp(opts.scenario, scenario.name) == 0) {
+      selected.push_back(&scenario);
+    }
+  }
+  if (selected.empty()) {
+    std::cerr << "Unknown scenario: " << opts.scenario << ".\n";
+    return 1;
+  }
+
+  std::cout << "{\n"
+            << "  \"seed\": " << opts.seed << ",\n"
+            << "  \"frames\": " << opts.frames << ",\n"
+            << "  \"frame_ms\": " << FRAME_MS << ",\n"
+            << "  \"threads\": " << (pool ? pool->size() : 1) << ",\n"
+            << "  \"renderer\": \"software\",\n"
+            << "  \"scenarios\": [\n";
+  for (size_t i = 0; i < selected.size(); i++) {
+    Results res = run_scenario(*selected[i], opts, &rend, &screen, &img,
+                               pool.get());
+    print_results(selected[i]->name, res, opts.frames,
+                  i + 1 == selected.size());
+  }
+  std::cout << "  ]\n}\n";
+
+  return 0;
+}
+
+} // end of BENCH
+
+int
+main(int argc, char **argv) {
+  BENCH::Options opts;
+  if (!BENCH::parse_options(argc, argv, &opts)) {
+    std::cerr << "Usage: " << argv[0] << " [--frames N] [--seed S]"
+              << " [--threads T] [--scenario bursts|cone|saturation]\n";
+    return 1;
+  }
+
+  try {
+    return BENCH::run(opts);
+  }
+  catch (std::exception &e) {
+    std::cerr << "Error: " << e.what() << ".\n";
+    return 1;
+  }
+}
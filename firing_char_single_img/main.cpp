@@ -4,13 +4,20 @@
 #include <stdexcept>
 #include <cmath>
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include "xSDL.hpp"
 #include "xSDL_image.hpp"
 #include "Graphical.hpp"
 #include "EngCharacter.hpp"
 #include "ParticlesSystem.hpp"
+#include "WorkerPool.hpp"
+#include "FrameTiming.hpp"
+#include "Trace.hpp"
+#include "InputRecording.hpp"
 #include "Atlas.hpp"
 #include "EngSkeleton.hpp"
 #include "xMath.hpp"
@@ -19,50 +26,298 @@ using xMATH::Float2;
 
 namespace GAME {
 
+// Phases of a frame, as timed by Main.
+enum {
+  PHASE_EVENTS,
+  PHASE_UPDATE,
+  PHASE_CHARACTER_RENDER,
+  PHASE_PARTICLES_UPDATE,
+  PHASE_PARTICLES_RENDER,
+  PHASE_PRESENT,
+  NUM_PHASES
+};
+
+static const char * const PHASE_NAMES[NUM_PHASES] = {
+  "events",
+  "update",
+  "character_render",
+  "particles_update",
+  "particles_render",
+  "present"
+};
+
+// Image files, loaded while the window is being created.
+enum {
+  ATLAS_IMAGE,
+  NUM_IMAGE_FILES
+};
+
+static const char * const IMAGE_FILES[NUM_IMAGE_FILES] = {
+  "atlas.png"
+};
+
+// Where the frame timings are written, on exit or when F2 is pressed.
+static const char * const TIMINGS_FILE = "frame_timings.csv";
+
+// Where the trace is written on exit, if built with TRACE_ENABLED.
+static const char * const TRACE_FILE = "frame_trace.json";
+
+// Set (to anything but "0"), has the game render offscreen, like --headless.
+static const char * const HEADLESS_ENV = "FIRING_CHAR_HEADLESS";
+
 class Main {
 public:
-  Main(const char * const title, const int width, const int height)
-    : sdl {SDL_INIT_VIDEO},
-      win {title, width, height},
-      rend {&win, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC},
+  enum {
+    DEFAULT_TICKS_PER_SECOND = 120,
+
+    // After a stall, at most this many ticks are simulated in a frame. The
+    // rest of the time is skipped rather than caught up with.
+    MAX_TICKS_PER_FRAME = 8
+  };
+
+  enum Output {
+    // A window, drawn with the accelerated renderer, in sync with the
+    // display.
+    WINDOW,
+
+    // An offscreen surface, drawn with the software renderer as fast as it
+    // goes. It needs no display.
+    OFFSCREEN
+  };
+
+  /**
+   * The simulation advances in fixed ticks, `ticks_per_second` of them per
+   * second, whatever the frame rate. Frames are drawn in between ticks.
+   */
+  Main(const char * const title, const int width, const int height,
+       const Output output = WINDOW,
+       const int ticks_per_second = DEFAULT_TICKS_PER_SECOND)
+    : ticks_per_second {uint32_t(ticks_per_second)},
+      seed {uint64_t(time(0))},
+      workers {WORK::Pool::default_num_workers()},
+      image_loads {&workers, IMAGE_FILES, NUM_IMAGE_FILES},
+      sdl(output == WINDOW ? SDL_INIT_VIDEO
+                           : SDL_INIT_TIMER | SDL_INIT_EVENTS),
+      win {output == WINDOW ? new xSDL::Window(title, width, height)
+                            : nullptr},
+      offscreen {output == OFFSCREEN ? new xSDL::Surface(width, height)
+                                     : nullptr},
+      rend {win ? xSDL::Renderer(win.get(), SDL_RENDERER_ACCELERATED |
+                                            SDL_RENDERER_PRESENTVSYNC)
+                : xSDL::Renderer(offscreen.get())},
       screen {&rend, width, height},
-      atlas {xIMG::load("atlas.png")},
-      skeleton {&screen, &atlas},
-      fire_particle {&screen, &atlas, ATLAS::piece_geom(ATLAS::CIRCLE_GRAD)},
-      player {Float2(0, 0), skeleton.images(), &fire_particle}
+      sprites {&screen},
+      atlas {&screen, image_loads.take(ATLAS_IMAGE)},
+      skeleton {&atlas},
+      eng_sprites {&screen, skeleton.images()},
+      particles {seed, ParticlesSystem::DEFAULT_MEMORY_BUDGET,
+                 &workers},
+      fire_particle {&atlas, ATLAS::piece_geom(ATLAS::CIRCLE_GRAD)},
+      player {Float2(0, 0), skeleton.images(), &fire_particle},
+      timings {PHASE_NAMES, NUM_PHASES},
+      recorder {},
+      replayer {}
   {
-    // I should learn how to use C++11's features for random numbers. I've read
-    // in too many places that C's rand/srand are terrible.
-    srand(time(0));
+    // The particles get the workers from now on.
+    image_loads.wait();
+  }
+
+  /**
+   * Records the run's input into `file_name`, to replay it later.
+   */
+  void
+  record_input(const char *file_name) {
+    recorder.reset(new INPUT::Recorder(file_name, seed));
+  }
+
+  /**
+   * Replays the input recorded into `file_name` instead of taking it live,
+   * on the recorded clock. The run ends with the recording.
+   */
+  void
+  replay_input(const char *file_name) {
+    replayer.reset(new INPUT::Replayer(file_name));
+    seed = replayer->seed();
+    particles.reseed(seed);
   }
 
   int
   run() {
+    TRACE_ThreadName("main");
+    TRACE_Zone("Main::run");
+
     player.set_speed(0.3f);
-    auto last_update = SDL_GetTicks();
+    player.use_sprite_cache(&eng_sprites);
+
+    // Times are kept in units of 1/ticks_per_second ms, so that a tick is
+    // exactly 1000 of them even when it isn't a whole number of ms.
+    uint32_t sim_start_ms;
+    if (!read_clock(&sim_start_ms)) {
+      return finish();
+    }
+    uint64_t sim_units = 0;
+    uint64_t lag_units = 0;
+    uint32_t last_frame_ms = sim_start_ms;
+
+    // Simulation time at the start and at the end of the last tick.
+    uint32_t tick_start_ms = sim_start_ms;
+    uint32_t sim_ms = sim_start_ms;
+
     for (;;) {
-      auto now = SDL_GetTicks();
+      TRACE_Zone("Main::frame");
+      timings.begin_frame();
+
+      uint32_t now;
+      if (!read_clock(&now)) {
+        return finish();
+      }
+      lag_units += uint64_t(now - last_frame_ms)*ticks_per_second;
+      last_frame_ms = now;
+
+      timings.begin(PHASE_EVENTS);
       SDL_Event event;
-      while (SDL_PollEvent(&event)) {
+      while (poll_event(&event)) {
         if (event.type == SDL_QUIT) {
-          return 0;
+          return finish();
         }
-        consume_event(event, now);
+        consume_event(event, sim_ms);
+      }
+      timings.end(PHASE_EVENTS);
+
+      for (int ticks = 0;
+           lag_units >= 1000 && ticks < MAX_TICKS_PER_FRAME;
+           ticks++)
+      {
+        sim_units += 1000;
+        lag_units -= 1000;
+        tick_start_ms = sim_ms;
+        sim_ms = sim_start_ms + uint32_t(sim_units/ticks_per_second);
+        update(sim_ms, sim_ms - tick_start_ms);
       }
+      lag_units %= 1000;
+
+      // How far into the next tick this frame is.
+      const float alpha = lag_units/1000.0f;
+
       rend.set_draw_color(xSDL::BLACK);
       rend.clear();
-      update_and_render(now, now-last_update);
-      last_update = now;
+      render(alpha, tick_start_ms + uint32_t(alpha*(sim_ms - tick_start_ms)));
+
+      timings.begin(PHASE_PRESENT);
       rend.present();
+      timings.end(PHASE_PRESENT);
+
+      timings.end_frame();
     }
   }
 
 private:
+  /**
+   * Ms since SDL started, or the next reading recorded if replaying. Returns
+   * false at the end of the replay.
+   */
+  bool
+  read_clock(uint32_t *ms) {
+    if (replayer) {
+      return replayer->clock(ms);
+    }
+    *ms = SDL_GetTicks();
+    if (recorder) {
+      recorder->clock(*ms);
+    }
+    return true;
+  }
+
+  bool
+  poll_event(SDL_Event *e) {
+    if (!replayer) {
+      if (!SDL_PollEvent(e)) {
+        return false;
+      }
+      if (recorder) {
+        recorder->event(*e);
+      }
+      return true;
+    }
+
+    if (replayer->poll_event(e)) {
+      return true;
+    }
+    // While replaying, live input is ignored. Other events, like the window
+    // closing, still go through.
+    while (SDL_PollEvent(e)) {
+      if (!INPUT::is_recorded(e->type) || e->type == SDL_QUIT) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int
+  finish() {
+    report_particles_stats();
+    report_sprite_cache_stats();
+    timings.write_summary(std::cerr);
+    write_timings();
+    return 0;
+  }
+
+  void
+  report_particles_stats() const {
+    const ParticlesStats& stats = particles.stats();
+    std::cerr << "Particles: " << stats.batches_spawned << " batches spawned, "
+              << stats.batches_dropped << " dropped, "
+              << stats.batches_peak_live << " peak live (capacity "
+              << stats.batches_capacity << "), "
+              << stats.bytes_reserved << " of " << stats.bytes_budget
+              << " bytes reserved.\n";
+  }
+
   void
-  update_and_render(uint32_t ms_now, uint32_t dt_ms) {
+  report_sprite_cache_stats() const {
+    std::cerr << "Engineer sprites: " << eng_sprites.poses_drawn()
+              << " poses drawn, " << eng_sprites.bytes_reserved() << " of "
+              << eng_sprites.bytes_budget() << " bytes of textures.\n";
+  }
+
+  void
+  write_timings() const {
+    std::ofstream out {TIMINGS_FILE};
+    timings.write_csv(out);
+    out.close();
+    if (!out) {
+      std::cerr << "Couldn't write the frame timings to " << TIMINGS_FILE
+                << ".\n";
+      return;
+    }
+    std::cerr << "Frame timings written to " << TIMINGS_FILE << ".\n";
+  }
+
+  void
+  update(uint32_t ms_now, uint32_t dt_ms) {
+    TRACE_Zone("Main::update");
+    TIMING::PhaseGuard phase_guard(&timings, PHASE_UPDATE);
     player.update(&particles, ms_now, dt_ms);
-    player.render(&screen);
-    particles.update_and_render(&screen, ms_now);
+  }
+
+  /**
+   * Draws things `alpha` of the way from the start of the last tick to its
+   * end. `ms_now` is the simulation time that far into the tick.
+   */
+  void
+  render(float alpha, uint32_t ms_now) {
+    TRACE_Zone("Main::render");
+    {
+      TIMING::PhaseGuard phase_guard(&timings, PHASE_CHARACTER_RENDER);
+      player.render(&sprites, alpha);
+      sprites.draw();
+    }
+    {
+      TIMING::PhaseGuard phase_guard(&timings, PHASE_PARTICLES_UPDATE);
+      particles.update(&screen, ms_now);
+    }
+    TIMING::PhaseGuard phase_guard(&timings, PHASE_PARTICLES_RENDER);
+    particles.render(&screen);
   }
 
   void
@@ -87,6 +342,11 @@ private:
               player.start_firing(ms_now);
             }
             break;
+          case SDLK_F2:
+            if (!e.key.repeat) {
+              write_timings();
+            }
+            break;
         }
         break;
       case SDL_KEYUP:
@@ -108,38 +368,100 @@ private:
             break;
         }
         break;
+      case SDL_RENDER_TARGETS_RESET:
+      case SDL_RENDER_DEVICE_RESET:
+        eng_sprites.invalidate();
+        screen.dirty_static_layers();
+        break;
+      // The position is taken from the event rather than the mouse's
+      // state, so that replays see it too.
       case SDL_MOUSEMOTION:
+        weapon_face(e.motion.x, e.motion.y);
+        break;
       case SDL_MOUSEBUTTONDOWN:
-      case SDL_MOUSEBUTTONUP: {
-        int x, y;
-        SDL_GetMouseState(&x, &y);
-        y = screen.height() - 1 - y;
-        player.weapon_face(Float2{float(x), float(y)});
+      case SDL_MOUSEBUTTONUP:
+        weapon_face(e.button.x, e.button.y);
         break;
-      }
     }
   }
 
+  void
+  weapon_face(int x, int y) {
+    y = screen.height() - 1 - y;
+    player.weapon_face(Float2{float(x), float(y)});
+  }
+
 private:
+  uint32_t ticks_per_second;
+  uint64_t seed;
+
+  WORK::Pool workers;
+  xIMG::AsyncLoad image_loads;
+
   xSDL::SDL sdl;
-  xSDL::Window win;
+  // Only one of them is there, depending on the output.
+  std::unique_ptr<xSDL::Window> win;
+  std::unique_ptr<xSDL::Surface> offscreen;
   xSDL::Renderer rend;
   GRAL::Screen screen;
-  xSDL::Surface atlas;
+  GRAL::SpriteBatch sprites;
+  // Every image is a view of it, so they're all drawn from one texture.
+  GRAL::Image atlas;
   EngSkeleton skeleton;
+  EngSpriteCache eng_sprites;
   ParticlesSystem particles;
   GRAL::Image fire_particle;
   EngCharacter player;
+  TIMING::FrameTimer timings;
+  std::unique_ptr<INPUT::Recorder> recorder;
+  std::unique_ptr<INPUT::Replayer> replayer;
 };
 
 }
 
 int
 main(int argc, char **argv) {
-  (void) argc;
-  (void) argv;
+  // --record FILE records the input into FILE, --replay FILE replays it.
+  // --headless renders offscreen.
+  const char *record_file = nullptr;
+  const char *replay_file = nullptr;
+  const char *headless_env = std::getenv(GAME::HEADLESS_ENV);
+  bool headless = headless_env && std::string(headless_env) != "0";
+  bool valid_args = true;
+  for (int i = 1; i < argc && valid_args; i++) {
+    if (std::string(argv[i]) == "--record" && i + 1 < argc) {
+      record_file = argv[++i];
+    }
+    else if (std::string(argv[i]) == "--replay" && i + 1 < argc) {
+      replay_file = argv[++i];
+    }
+    else if (std::string(argv[i]) == "--headless") {
+      headless = true;
+    }
+    else {
+      valid_args = false;
+    }
+  }
+  // A replay takes neither the live clock nor live input, so recording it
+  // would only write the header.
+  if (!valid_args || (record_file && replay_file)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--headless] [--record FILE | --replay FILE]\n";
+    return 2;
+  }
+
   try {
-    return GAME::Main("Walking Character", 800, 600).run();
+    GAME::Main game {"Walking Character", 800, 600,
+                     headless ? GAME::Main::OFFSCREEN : GAME::Main::WINDOW};
+    if (record_file) {
+      game.record_input(record_file);
+    }
+    if (replay_file) {
+      game.replay_input(replay_file);
+    }
+    const int status = game.run();
+    TRACE_Write(GAME::TRACE_FILE);
+    return status;
   }
   catch (std::exception &e) {
     std::cerr << "Error: " << e.what() << ".\n";
@@ -1,6 +1,8 @@
 #ifndef X_MATH_HPP
 #define X_MATH_HPP
 
+#include <cmath>
+
 namespace xMATH {
 
 template<typename Number>
@@ -157,6 +159,95 @@ rotate(const Float2 a, const Float2 cos_sin) {
                 cos_sin.y()*a.x() + cos_sin.x()*a.y());
 }
 
+/**
+ * Returns vector `a` rotated by `quarters` quarter turns (counterclockwise).
+ * Unlike rotate, it's exact.
+ */
+constexpr inline Float2
+rotate_quarters(const Float2 a, int quarters) {
+  return (quarters & 3) == 0 ? a :
+         (quarters & 3) == 1 ? Float2(-a.y(), a.x()) :
+         (quarters & 3) == 2 ? Float2(-a.x(), -a.y()) :
+                               Float2(a.y(), -a.x());
+}
+
+/**
+ * A rotation followed by a translation: it takes point p to
+ * rotate(p, cos_sin) + offset. The angle is kept along with its cosine and
+ * sine, so neither applying nor composing transforms takes any trigonometry.
+ */
+struct Transform2D {
+  float angle;
+  Float2 cos_sin;
+  Float2 offset;
+
+  Transform2D()
+  {}
+
+  /**
+   * Rotates by `angle` (in radians) around the origin, then translates by
+   * `offset`.
+   */
+  Transform2D(float angle, Float2 offset = Float2(0.0f, 0.0f))
+    : Transform2D(angle, Float2(std::cos(angle), std::sin(angle)), offset)
+  {}
+
+  /**
+   * For when the cosine and sine of `angle` are already known.
+   */
+  constexpr
+  Transform2D(float angle, Float2 cos_sin, Float2 offset)
+    : angle {angle}, cos_sin {cos_sin}, offset {offset}
+  {}
+
+  /**
+   * Rotates by `angle` around `pivot`.
+   */
+  static Transform2D
+  rotation_around(float angle, Float2 pivot) {
+    const Float2 cos_sin(std::cos(angle), std::sin(angle));
+    return Transform2D(angle, cos_sin, pivot - rotate(pivot, cos_sin));
+  }
+
+  constexpr Float2
+  apply(Float2 p) const {
+    return rotate(p, cos_sin) + offset;
+  }
+
+  /**
+   * Applies only the rotation, as for directions.
+   */
+  constexpr Float2
+  apply_rotation(Float2 v) const {
+    return rotate(v, cos_sin);
+  }
+
+  /**
+   * Rotates further by `quarters` quarter turns, before the translation.
+   */
+  constexpr Transform2D
+  turned(int quarters) const {
+    return Transform2D(angle + quarters*PI<float>()*0.5f,
+                       rotate_quarters(cos_sin, quarters),
+                       offset);
+  }
+
+  constexpr Transform2D
+  inverse() const {
+    return Transform2D(-angle, Float2(cos_sin.x(), -cos_sin.y()),
+                       -rotate(offset, Float2(cos_sin.x(), -cos_sin.y())));
+  }
+};
+
+/**
+ * Composes transforms: (a*b).apply(p) is a.apply(b.apply(p)).
+ */
+constexpr inline Transform2D
+operator * (const Transform2D &a, const Transform2D &b) {
+  return Transform2D(a.angle + b.angle, rotate(b.cos_sin, a.cos_sin),
+                     a.apply(b.offset));
+}
+
 }
 
 #endif
@@ -0,0 +1,134 @@
+#ifndef X_RANDOM_HPP
+#define X_RANDOM_HPP
+
+#include <cstdint>
+
+namespace xMATH {
+
+/**
+ * A small and fast pseudo random number generator: 4 independent
+ * xoshiro128+ generators running side by side. Stepping all of them at once
+ * is a handful of 32 bits operations on 4 lanes, which compilers turn into
+ * SIMD code, so filling arrays (fill_01) is considerably cheaper than asking
+ * for numbers one at a time.
+ *
+ * The sequence is completely determined by the seed, so seed it explicitly
+ * (e.g. with the time) and keep the seed around if you want to reproduce a
+ * run.
+ *
+ * Instances aren't thread safe. Give each thread its own, e.g. with split().
+ */
+class Random {
+public:
+  enum {
+    LANES = 4
+  };
+
+  explicit Random(uint64_t seed) noexcept {
+    reseed(seed);
+  }
+
+  void
+  reseed(uint64_t seed) noexcept {
+    // Seeding with splitmix64 is what the xoshiro authors recommend: it never
+    // gives an all zeros state, and similar seeds give unrelated states.
+    for (int i = 0; i < 4; i++) {
+      for (int lane = 0; lane < LANES; lane += 2) {
+        const uint64_t x = splitmix64(seed);
+        s[i][lane] = uint32_t(x);
+        s[i][lane + 1] = uint32_t(x >> 32);
+      }
+    }
+    buffered = 0;
+  }
+
+  /**
+   * A generator whose sequence is unrelated to this one's, for handing to
+   * another thread. This one's sequence advances.
+   */
+  Random
+  split() noexcept {
+    uint64_t seed = uint64_t(next_u32()) << 32;
+    seed |= next_u32();
+    return Random(seed);
+  }
+
+  uint32_t
+  next_u32() noexcept {
+    if (buffered == 0) {
+      step(buffer);
+      buffered = LANES;
+    }
+    return buffer[--buffered];
+  }
+
+  /**
+   * Uniform float in [0, 1).
+   */
+  float
+  uniform_01() noexcept {
+    return to_01(next_u32());
+  }
+
+  /**
+   * Fills out[0..n) with uniform floats in [0, 1).
+   */
+  void
+  fill_01(float *out, int n) noexcept {
+    int i = 0;
+    for (; i + LANES <= n; i += LANES) {
+      uint32_t x[LANES];
+      step(x);
+      for (int lane = 0; lane < LANES; lane++) {
+        out[i + lane] = to_01(x[lane]);
+      }
+    }
+    for (; i < n; i++) {
+      out[i] = uniform_01();
+    }
+  }
+
+private:
+  static uint64_t
+  splitmix64(uint64_t &state) noexcept {
+    uint64_t z = (state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+  }
+
+  static float
+  to_01(uint32_t x) noexcept {
+    // The top 24 bits are as many as a float's mantissa holds.
+    return (x >> 8) * (1.0f/16777216.0f);
+  }
+
+  /**
+   * One xoshiro128+ step of every lane.
+   */
+  void
+  step(uint32_t out[LANES]) noexcept {
+    for (int lane = 0; lane < LANES; lane++) {
+      out[lane] = s[0][lane] + s[3][lane];
+
+      const uint32_t t = s[1][lane] << 9;
+      s[2][lane] ^= s[0][lane];
+      s[3][lane] ^= s[1][lane];
+      s[1][lane] ^= s[2][lane];
+      s[0][lane] ^= s[3][lane];
+      s[2][lane] ^= t;
+      s[3][lane] = (s[3][lane] << 11) | (s[3][lane] >> 21);
+    }
+  }
+
+  // s[i][lane] is the i-th word of the lane's state. Laid out this way, each
+  // word of all the lanes fits in one SIMD register.
+  alignas(16) uint32_t s[4][LANES];
+
+  uint32_t buffer[LANES];
+  int buffered;
+};
+
+} // end of xmath
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdexcept>
 
 #include "xSDL.hpp"
+#include "Trace.hpp"
 
 #define ERR(ex_type, msg) \
   do { \
@@ -35,14 +36,14 @@ SDL::
 // surface
 
 Surface::
-Surface(Surface *src, const Rect& rect)
-  : surf(SDL_CreateRGBSurface(0, rect.w, rect.h,
+Surface(Surface *src, const Rect& rect) {
+  TRACE_Zone("xSDL::Surface");
+  surf = SDL_CreateRGBSurface(0, rect.w, rect.h,
                               src->surf->format->BitsPerPixel,
                               src->surf->format->Rmask,
                               src->surf->format->Gmask,
                               src->surf->format->Bmask,
-                              src->surf->format->Amask))
-{
+                              src->surf->format->Amask);
   if (!surf) {
     ERR(ResourceCreateError, SDL_GetError());
   }
@@ -52,6 +53,26 @@ Surface(Surface *src, const Rect& rect)
   }
 }
 
+Surface::
+Surface(int width, int height) {
+  TRACE_Zone("xSDL::Surface");
+  surf = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32,
+                                        SDL_PIXELFORMAT_RGBA32);
+  if (!surf) {
+    ERR(ResourceCreateError, SDL_GetError());
+  }
+}
+
+void
+Surface::
+fill(Color c) {
+  if (SDL_FillRect(surf, nullptr,
+                   SDL_MapRGBA(surf->format, c.r, c.g, c.b, c.a)) < 0)
+  {
+    ERR(ResourceAlterError, SDL_GetError());
+  }
+}
+
 int
 Surface::
 width() const noexcept {
@@ -73,13 +94,45 @@ free() noexcept {
   }
 }
 
+////
+// blend modes
+
+BlendMode
+premultiplied_compose_blend_mode() noexcept {
+  return SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_SRC_ALPHA,
+                                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                    SDL_BLENDOPERATION_ADD,
+                                    SDL_BLENDFACTOR_ONE,
+                                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                    SDL_BLENDOPERATION_ADD);
+}
+
+BlendMode
+premultiplied_blend_mode() noexcept {
+  return SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE,
+                                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                    SDL_BLENDOPERATION_ADD,
+                                    SDL_BLENDFACTOR_ONE,
+                                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                    SDL_BLENDOPERATION_ADD);
+}
+
 ////
 // renderer
 
 Renderer::
-Renderer(Window *win, int flags)
-  : rend {SDL_CreateRenderer(win->win, -1, flags)}
-{
+Renderer(Window *win, int flags) {
+  TRACE_Zone("xSDL::Renderer");
+  rend = SDL_CreateRenderer(win->win, -1, flags);
+  if (!rend) {
+    ERR(ResourceCreateError, SDL_GetError());
+  }
+}
+
+Renderer::
+Renderer(Surface *target) {
+  TRACE_Zone("xSDL::Renderer");
+  rend = SDL_CreateSoftwareRenderer(target->surf);
   if (!rend) {
     ERR(ResourceCreateError, SDL_GetError());
   }
@@ -99,6 +152,20 @@ copy(Texture *texture,
   }
 }
 
+void
+Renderer::
+geometry(Texture *texture,
+         const Vertex *vertices, int num_vertices,
+         const int *indices, int num_indices)
+{
+  SDL_Texture *tex = texture ? texture->tex : nullptr;
+  if (SDL_RenderGeometry(rend, tex, vertices, num_vertices,
+                         indices, num_indices) < 0)
+  {
+    ERR(RenderError, SDL_GetError());
+  }
+}
+
 void
 Renderer::
 fill_rectangle(const Rect& rect) {
@@ -107,9 +174,46 @@ fill_rectangle(const Rect& rect) {
   }
 }
 
+void
+Renderer::
+set_target(Texture *target) {
+  if (SDL_SetRenderTarget(rend, target ? target->tex : nullptr) < 0) {
+    ERR(RenderError, SDL_GetError());
+  }
+}
+
+bool
+Renderer::
+supports_targets() const noexcept {
+  return SDL_RenderTargetSupported(rend);
+}
+
+bool
+Renderer::
+supports_blend_mode(BlendMode mode) {
+  // Renderers refuse the modes they can't draw with when they're set.
+  SDL_Texture *probe = SDL_CreateTexture(rend, SDL_PIXELFORMAT_RGBA32,
+                                         SDL_TEXTUREACCESS_STATIC, 1, 1);
+  if (!probe) {
+    ERR(ResourceCreateError, SDL_GetError());
+  }
+  const bool supported = SDL_SetTextureBlendMode(probe, mode) == 0;
+  SDL_DestroyTexture(probe);
+  return supported;
+}
+
+void
+Renderer::
+draw_line(int x1, int y1, int x2, int y2) {
+  if (SDL_RenderDrawLine(rend, x1, y1, x2, y2) < 0) {
+    ERR(RenderError, SDL_GetError());
+  }
+}
+
 void
 Renderer::
 present() noexcept {
+  TRACE_Zone("xSDL::Renderer::present");
   SDL_RenderPresent(rend);
 }
 
@@ -133,66 +237,146 @@ set_draw_color(Color c) {
 // Texture
 
 Texture::
-Texture(Renderer *rend, Surface *surf)
-  : tex {SDL_CreateTextureFromSurface(rend->rend, surf->surf)}
-{
+Texture(Renderer *rend, Surface *surf) {
+  TRACE_Zone("xSDL::Texture");
+  tex = SDL_CreateTextureFromSurface(rend->rend, surf->surf);
   if (!tex) {
     ERR(ResourceCreateError, SDL_GetError());
   }
+  try {
+    read_state();
+  }
+  catch (...) {
+    SDL_DestroyTexture(tex);
+    throw;
+  }
+}
+
+Texture::
+Texture(Renderer *rend, int width, int height) {
+  TRACE_Zone("xSDL::Texture");
+  tex = SDL_CreateTexture(rend->rend, SDL_PIXELFORMAT_RGBA32,
+                          SDL_TEXTUREACCESS_TARGET, width, height);
+  if (!tex) {
+    ERR(ResourceCreateError, SDL_GetError());
+  }
+  try {
+    // Target textures aren't blended by default.
+    if (SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND) < 0) {
+      ERR(ResourceAlterError, SDL_GetError());
+    }
+    read_state();
+  }
+  catch (...) {
+    SDL_DestroyTexture(tex);
+    throw;
+  }
+}
+
+Texture::
+Texture(Texture&& src) noexcept
+  : tex {src.tex},
+    alpha_mod {src.alpha_mod},
+    color_mod {src.color_mod},
+    blend_mode {src.blend_mode}
+{
+  src.tex = nullptr;
+}
+
+Texture&
+Texture::
+operator=(Texture&& src) noexcept {
+  // Self move assign?
+  if (src.tex != tex) {
+    if (tex) {
+      SDL_DestroyTexture(tex);
+    }
+    tex = src.tex;
+    alpha_mod = src.alpha_mod;
+    color_mod = src.color_mod;
+    blend_mode = src.blend_mode;
+    src.tex = nullptr;
+  }
+  return *this;
+}
+
+Texture::
+~Texture() noexcept {
+  if (tex) {
+    SDL_DestroyTexture(tex);
+    tex = nullptr;
+  }
+}
+
+void
+Texture::
+read_state() {
+  uint8_t r, g, b;
+  if (SDL_GetTextureAlphaMod(tex, &alpha_mod) < 0 ||
+      SDL_GetTextureColorMod(tex, &r, &g, &b) < 0 ||
+      SDL_GetTextureBlendMode(tex, &blend_mode) < 0)
+  {
+    ERR(ResourceReadError, SDL_GetError());
+  }
+  color_mod = {r, g, b};
 }
 
 void
 Texture::
 set_alpha_mod(uint8_t alpha_mod) {
+  if (alpha_mod == this->alpha_mod) {
+    return;
+  }
   if (SDL_SetTextureAlphaMod(tex, alpha_mod) < 0) {
     ERR(ResourceAlterError, SDL_GetError());
   }
+  this->alpha_mod = alpha_mod;
 }
 
 void
 Texture::
 set_color_mod(Color color_mod) {
+  // Only r, g and b make up the color mod.
+  if (color_mod.r == this->color_mod.r &&
+      color_mod.g == this->color_mod.g &&
+      color_mod.b == this->color_mod.b)
+  {
+    return;
+  }
   if (SDL_SetTextureColorMod(tex, color_mod.r, color_mod.g, color_mod.b) < 0) {
     ERR(ResourceAlterError, SDL_GetError());
   }
+  this->color_mod = {color_mod.r, color_mod.g, color_mod.b};
 }
 
 void
 Texture::
 set_blend_mode(BlendMode mode) {
+  if (mode == blend_mode) {
+    return;
+  }
   if (SDL_SetTextureBlendMode(tex, mode) < 0) {
     ERR(ResourceAlterError, SDL_GetError());
   }
+  blend_mode = mode;
 }
 
 uint8_t
 Texture::
 get_alpha_mod() const {
-  uint8_t mod;
-  if (SDL_GetTextureAlphaMod(tex, &mod) < 0) {
-    ERR(ResourceReadError, SDL_GetError());
-  }
-  return mod;
+  return alpha_mod;
 }
 
 Color
 Texture::
 get_color_mod() const {
-  uint8_t r, g, b;
-  if (SDL_GetTextureColorMod(tex, &r, &g, &b) < 0) {
-    ERR(ResourceReadError, SDL_GetError());
-  }
-  return {r, g, b};
+  return color_mod;
 }
 
 BlendMode
 Texture::
 get_blend_mode() const {
-  BlendMode mode;
-  if (SDL_GetTextureBlendMode(tex, &mode) < 0) {
-    ERR(ResourceReadError, SDL_GetError());
-  }
-  return mode;
+  return blend_mode;
 }
 
 ////
@@ -201,8 +385,9 @@ get_blend_mode() const {
 Window::
 Window(const char *title, int x_pos, int y_pos, int width, int height,
        int flags)
-  : win {SDL_CreateWindow(title, x_pos, y_pos, width, height, flags)}
 {
+  TRACE_Zone("xSDL::Window");
+  win = SDL_CreateWindow(title, x_pos, y_pos, width, height, flags);
   //if (!win) {
     ERR(ResourceCreateError, SDL_GetError());
   //}
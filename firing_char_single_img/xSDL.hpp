@@ -190,6 +190,7 @@ struct SDL {
 
 class Surface {
   friend class Texture;
+  friend class Renderer;
 
   X_SDL_RESOURCE_COMMON_BODY(Surface, SDL_Surface*, surf, SDL_FreeSurface)
 
@@ -198,6 +199,12 @@ public:
   // surface.
   Surface(Surface *surf, const Rect& rect);
 
+  // Creates a blank 32 bits RGBA surface.
+  Surface(int width, int height);
+
+  void
+  fill(Color c);
+
   int
   width() const noexcept;
 
@@ -214,6 +221,22 @@ public:
 
 using RenderFlip = SDL_RendererFlip;
 using BlendMode = SDL_BlendMode;
+using Vertex = SDL_Vertex;
+
+/**
+ * For drawing straight alpha images into a texture cleared to transparent,
+ * so that it ends up holding premultiplied colors, and the right alpha.
+ */
+BlendMode
+premultiplied_compose_blend_mode() noexcept;
+
+/**
+ * For drawing textures holding premultiplied colors, like the ones drawn
+ * into with premultiplied_compose_blend_mode. SDL_BLENDMODE_BLEND would
+ * apply their alpha a second time.
+ */
+BlendMode
+premultiplied_blend_mode() noexcept;
 
 class Renderer {
   friend class Texture;
@@ -224,12 +247,46 @@ class Renderer {
 public:
   Renderer(Window *win, int flags);
 
+  /**
+   * A software renderer drawing into `target`, which must outlive it. It
+   * needs no window, nor video initialization.
+   */
+  explicit Renderer(Surface *target);
+
   void
   copy(Texture *Texture,
        const Rect* src, const Rect* dest,
        double angle, const Point *center_rot,
        RenderFlip flip = SDL_FLIP_NONE);
 
+  /**
+   * Renders triangles textured by `texture` (it can be null). If `indices`
+   * is null, vertices are taken sequentially, 3 for each triangle.
+   */
+  void
+  geometry(Texture *texture,
+           const Vertex *vertices, int num_vertices,
+           const int *indices, int num_indices);
+
+  /**
+   * Makes `target` (a texture created to be drawn into) what gets drawn to
+   * from now on. Null goes back to the window, or to the surface of a
+   * software renderer.
+   */
+  void
+  set_target(Texture *target);
+
+  bool
+  supports_targets() const noexcept;
+
+  /**
+   * Whether textures can be drawn with `mode`. Custom modes (see
+   * SDL_ComposeCustomBlendMode) aren't supported by every renderer, e.g.
+   * not by the software one.
+   */
+  bool
+  supports_blend_mode(BlendMode mode);
+
   void
   present() noexcept;
 
@@ -241,20 +298,45 @@ public:
 
   void
   fill_rectangle(const Rect& Rect);
+
+  void
+  draw_line(int x1, int y1, int x2, int y2);
 };
 
 ////
 // Texture
 
+/**
+ * Besides the SDL texture, this keeps a copy of its alpha mod, color mod and
+ * blend mode. The getters read the copy, and the setters don't call into SDL
+ * if the value doesn't change. This makes saving, changing and restoring that
+ * state (as GRAL's guards do) nearly free when the value is already the
+ * wanted one.
+ *
+ * This only works as long as the texture's state isn't changed behind the
+ * object's back, so don't change it other than through it.
+ */
 class Texture {
   friend class Renderer;
 
-  X_SDL_RESOURCE_COMMON_BODY(Texture, SDL_Texture*, tex,
-                             SDL_DestroyTexture)
-
 public:
   Texture(Renderer *rend, Surface *surf);
 
+  /**
+   * Creates a blank 32 bits RGBA texture that can be drawn into (see
+   * Renderer::set_target). It's alpha blended when drawn, like textures
+   * created from surfaces.
+   */
+  Texture(Renderer *rend, int width, int height);
+
+  Texture& operator=(const Texture&) = delete;
+  Texture(const Texture&) = delete;
+
+  Texture& operator=(Texture&& src) noexcept;
+  Texture(Texture&& src) noexcept;
+
+  ~Texture() noexcept;
+
   void
   set_alpha_mod(uint8_t alpha_mod);
 
@@ -272,6 +354,18 @@ public:
 
   BlendMode
   get_blend_mode() const;
+
+private:
+  /**
+   * Reads the texture's state into the copies.
+   */
+  void
+  read_state();
+
+  SDL_Texture *tex;
+  uint8_t alpha_mod;
+  Color color_mod;
+  BlendMode blend_mode;
 };
 
 ////
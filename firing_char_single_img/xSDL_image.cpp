@@ -1,4 +1,12 @@
+#include <exception>
+#include <future>
+#include <thread>
+#include <vector>
+
 #include "xSDL.hpp"
+#include "xSDL_image.hpp"
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
 
 #include <SDL2/SDL_image.h>
 
@@ -6,6 +14,7 @@ namespace xIMG {
 
 xSDL::Surface
 load(const char *file_name) {
+  TRACE_Zone("xIMG::load");
   SDL_Surface *surf = IMG_Load(file_name);
   if (!surf) {
     throw xSDL::IOLoadError(IMG_GetError());
@@ -13,4 +22,56 @@ load(const char *file_name) {
   return xSDL::Surface(surf);
 }
 
+AsyncLoad::
+AsyncLoad(WORK::Pool *pool, const char * const *file_names, int num_files)
+  : promises(num_files),
+    surfaces {},
+    runner {}
+{
+  surfaces.reserve(num_files);
+  for (std::promise<xSDL::Surface> &promise : promises) {
+    surfaces.push_back(promise.get_future());
+  }
+
+  // Loading the PNG library isn't thread safe, so it's done up front.
+  IMG_Init(IMG_INIT_PNG);
+
+  runner = std::thread([this, pool, file_names, num_files] {
+    TRACE_ThreadName("image loader");
+    pool->for_each(num_files, [this, file_names](int i) {
+      try {
+        try {
+          promises[i].set_value(load(file_names[i]));
+        }
+        catch (...) {
+          promises[i].set_exception(std::current_exception());
+        }
+      }
+      catch (...) {
+        // Only if the error couldn't be stored. The file is then reported
+        // as a broken promise.
+      }
+    });
+  });
+}
+
+AsyncLoad::
+~AsyncLoad() {
+  wait();
+}
+
+xSDL::Surface
+AsyncLoad::
+take(int i) {
+  return surfaces[i].get();
+}
+
+void
+AsyncLoad::
+wait() {
+  if (runner.joinable()) {
+    runner.join();
+  }
+}
+
 } // ximg
@@ -1,13 +1,64 @@
 #ifndef X_SDL_IMAGE_HPP
 #define X_SDL_IMAGE_HPP
 
+#include <future>
+#include <thread>
+#include <vector>
+
 #include "xSDL.hpp"
+#include "WorkerPool.hpp"
 
 namespace xIMG {
 
 xSDL::Surface
 load(const char *file_name);
 
+/**
+ * Loads image files on the threads of a pool, in the background: the
+ * constructor returns right away, and each file can be waited for on its
+ * own. Meanwhile, the calling thread can get on with something else, like
+ * creating the window, or textures for the files already loaded (which has
+ * to be done on the thread rendering).
+ *
+ * @note The pool mustn't be used by anything else until wait() returns.
+ */
+class AsyncLoad {
+public:
+  /**
+   * `file_names` must outlive the load.
+   */
+  AsyncLoad(WORK::Pool *pool, const char * const *file_names,
+            int num_files);
+
+  /**
+   * Waits for every file.
+   */
+  ~AsyncLoad();
+
+  AsyncLoad(const AsyncLoad&) = delete;
+  AsyncLoad& operator=(const AsyncLoad&) = delete;
+
+  /**
+   * Waits for file `i`, and hands its surface over. Throws xSDL::IOLoadError
+   * if it couldn't be loaded. Each file can only be taken once.
+   */
+  xSDL::Surface
+  take(int i);
+
+  /**
+   * Waits for every file, taken or not.
+   */
+  void
+  wait();
+
+private:
+  std::vector<std::promise<xSDL::Surface>> promises;
+  std::vector<std::future<xSDL::Surface>> surfaces;
+
+  // Runs the pool, so that this thread doesn't have to.
+  std::thread runner;
+};
+
 } // ximg
 
 #endif
@@ -13,15 +13,97 @@ RAND_01_f() {
   return rand()/(float)RAND_MAX;
 }
 
+static const size_t CHUNK_BYTES =
+  PARTS_BATCHES_PER_CHUNK*(sizeof (PARTS_Batch) + 2*sizeof (PARTS_Batch*));
+
+void
+PARTS_Setup(PARTS *parts, size_t memory_budget) {
+  *parts = (PARTS) {
+    .stats = {
+      .bytes_budget = memory_budget
+    }
+  };
+}
+
+void
+PARTS_Destroy(PARTS *parts) {
+  for (int i = 0; i < parts->num_chunks; i++) {
+    free(parts->chunks[i]);
+  }
+  free(parts->chunks);
+  free(parts->free_batches);
+  free(parts->live_batches);
+  PARTS_Setup(parts, parts->stats.bytes_budget);
+}
+
+void
+PARTS_ReadStats(const PARTS *parts, struct PARTS_Stats *stats) {
+  *stats = parts->stats;
+}
+
+/**
+ * Reserves one more chunk of batches if the budget allows it. Returns 0 on
+ * success and -1 if the budget doesn't allow it or an allocation failed.
+ */
+static int
+Grow(PARTS *parts) {
+  struct PARTS_Stats *stats = &parts->stats;
+  if (stats->bytes_reserved + CHUNK_BYTES > stats->bytes_budget) {
+    return -1;
+  }
+
+  int capacity = stats->batches_capacity + PARTS_BATCHES_PER_CHUNK;
+  size_t ptrs_size = capacity*sizeof (PARTS_Batch*);
+
+  // Each array is stored back as soon as it's reallocated, so a failure
+  // halfway leaves parts consistent (with larger arrays than needed).
+  PARTS_Batch **chunks = realloc(parts->chunks,
+                                 (parts->num_chunks + 1)*sizeof *chunks);
+  if (!chunks) {
+    return -1;
+  }
+  parts->chunks = chunks;
+
+  PARTS_Batch **free_batches = realloc(parts->free_batches, ptrs_size);
+  if (!free_batches) {
+    return -1;
+  }
+  parts->free_batches = free_batches;
+
+  PARTS_Batch **live_batches = realloc(parts->live_batches, ptrs_size);
+  if (!live_batches) {
+    return -1;
+  }
+  parts->live_batches = live_batches;
+
+  PARTS_Batch *chunk = malloc(PARTS_BATCHES_PER_CHUNK*sizeof *chunk);
+  if (!chunk) {
+    return -1;
+  }
+  parts->chunks[parts->num_chunks++] = chunk;
+
+  for (int i = PARTS_BATCHES_PER_CHUNK-1; i >= 0; i--) {
+    parts->free_batches[parts->num_free++] = chunk + i;
+  }
+
+  stats->batches_capacity = capacity;
+  stats->bytes_reserved += CHUNK_BYTES;
+  return 0;
+}
+
 void
 PARTS_AddBatch(PARTS *parts,
                const struct PARTS_BatchSetup* setup)
 {
-  if (parts->batches_used == PARTS_MAX_BATCHES) {
+  struct PARTS_Stats *stats = &parts->stats;
+
+  if (parts->num_free == 0 && Grow(parts) < 0) {
+    stats->batches_dropped++;
     return;
   }
 
-  PARTS_Batch *batch = parts->batches + parts->batches_used;
+  PARTS_Batch *batch = parts->free_batches[--parts->num_free];
+  parts->live_batches[stats->batches_live++] = batch;
   batch->img = setup->img;
   batch->ms_duration = setup->ms_duration;
   batch->ms_start = setup->ms_start;
@@ -40,7 +122,10 @@ PARTS_AddBatch(PARTS *parts,
     };
   }
 
-  parts->batches_used++;
+  stats->batches_spawned++;
+  if (stats->batches_live > stats->batches_peak_live) {
+    stats->batches_peak_live = stats->batches_live;
+  }
 }
 
 void
@@ -48,15 +133,19 @@ PARTS_UpdateAndRender(PARTS *parts,
                       GRAL_Screen *screen,
                       Uint32 ms_now)
 {
+  PARTS_Batch **live = parts->live_batches;
+  int *num_live = &parts->stats.batches_live;
   int i = 0;
 
-  while (i < parts->batches_used) {
-    PARTS_Batch *batch = parts->batches + i;
+  while (i < *num_live) {
+    PARTS_Batch *batch = live[i];
     float dt = ms_now - batch->ms_start;
 
     if (dt > batch->ms_duration) {
-      *batch = parts->batches[parts->batches_used - 1];
-      parts->batches_used--;
+      // Only the pointer moves; the batch goes back to the free list.
+      parts->free_batches[parts->num_free++] = batch;
+      live[i] = live[*num_live - 1];
+      (*num_live)--;
       continue;
     }
 
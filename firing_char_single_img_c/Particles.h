@@ -9,9 +9,15 @@
  * - To call PARTS_AddBatch, you'll need to declare a variable of
  * struct PARTS_BatchSetup (not an "opaque-ish" type), and fill it in with
  * intended values.
+ * - Call PARTS_Destroy when you're done with it.
+ *
+ * Batches are reserved in chunks, as they're needed, up to the memory budget
+ * given to PARTS_Setup. When it's exhausted, new batches are dropped. Use
+ * PARTS_ReadStats to find out how often that happens.
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <SDL2/SDL.h>
 
@@ -30,11 +36,36 @@ struct PARTS_BatchSetup {
   GRAL_Image *img;
 };
 
+/**
+ * Counters kept since PARTS_Setup. They're meant for sizing the memory
+ * budget from real sessions.
+ */
+struct PARTS_Stats {
+  // Batches successfully added.
+  Uint64 batches_spawned;
+
+  // Batches that couldn't be added because the memory budget was exhausted
+  // (or an allocation failed).
+  Uint64 batches_dropped;
+
+  int batches_live;
+  int batches_peak_live;
+
+  // Number of batches the currently reserved memory can hold.
+  int batches_capacity;
+
+  // Memory held for batches, and how much it's allowed to grow to.
+  size_t bytes_reserved;
+  size_t bytes_budget;
+};
+
 enum {
-  PARTS_MAX_BATCHES = 1 << 8,
+  PARTS_BATCHES_PER_CHUNK = 1 << 6,
   PARTS_PER_BATCH = 30,
 };
 
+#define PARTS_DEFAULT_MEMORY_BUDGET ((size_t) 4 << 20)
+
 struct PARTS_Batch {
   GRAL_Image *img;
   vec2f start_position;
@@ -51,16 +82,33 @@ typedef struct PARTS_Batch PARTS_Batch;
 typedef struct PARTS_Each PARTS_Each;
 
 struct PARTS {
-  PARTS_Batch batches[PARTS_MAX_BATCHES];
-  int batches_used;
+  // Batches never move once added, so the other arrays can point into the
+  // chunks.
+  PARTS_Batch **chunks;
+  int num_chunks;
+
+  PARTS_Batch **free_batches;
+  int num_free;
+
+  PARTS_Batch **live_batches;
+
+  struct PARTS_Stats stats;
 };
 
 typedef struct PARTS PARTS;
 
-static inline void
-PARTS_Setup(PARTS *parts) {
-  parts->batches_used = 0;
-}
+/**
+ * Nothing is allocated until the first batch is added, and never more than
+ * memory_budget bytes (PARTS_DEFAULT_MEMORY_BUDGET is a sensible value).
+ */
+void
+PARTS_Setup(PARTS *parts, size_t memory_budget);
+
+void
+PARTS_Destroy(PARTS *parts);
+
+void
+PARTS_ReadStats(const PARTS *parts, struct PARTS_Stats *stats);
 
 void
 PARTS_AddBatch(PARTS *parts,
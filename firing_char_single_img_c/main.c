@@ -51,6 +51,7 @@ static PARTS parts;
 
 static void
 Cleanup(void) {
+  PARTS_Destroy(&parts);
   if (atlas) {
     SDL_FreeSurface(atlas);
   }
@@ -98,7 +99,7 @@ GameSetup(const char *title, int win_w, int win_h) {
   ENG_Setup(&player, (vec2f) {0.0f, 0.0f}, &eng_skeleton, &fire_particle,
             1.0f/50.0f);
 
-  PARTS_Setup(&parts);
+  PARTS_Setup(&parts, PARTS_DEFAULT_MEMORY_BUDGET);
 }
 
 static void
@@ -163,6 +164,19 @@ ConsumeEvent(SDL_Event *e, Uint32 ms_now) {
   }
 }
 
+static void
+ReportParticlesStats(void) {
+  struct PARTS_Stats stats;
+  PARTS_ReadStats(&parts, &stats);
+  fprintf(stderr, "Particles: %llu batches spawned, %llu dropped, "
+                  "%d peak live (capacity %d), "
+                  "%zu of %zu bytes reserved.\n",
+                  (unsigned long long) stats.batches_spawned,
+                  (unsigned long long) stats.batches_dropped,
+                  stats.batches_peak_live, stats.batches_capacity,
+                  stats.bytes_reserved, stats.bytes_budget);
+}
+
 static int
 Run() {
   ENG_SetSpeed(&player, 0.3f);
@@ -172,6 +186,7 @@ Run() {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
       if (event.type == SDL_QUIT) {
+        ReportParticlesStats();
         return 0;
       }
       ConsumeEvent(&event, now);